@@ -8,14 +8,20 @@
  * systems. MAIN, in particular, refers to how main() should be declared, and
  * the rest should be self-explanatory from their standard values.
  *
- * Only this file and slip.c should contain anything system-dependent
- * (ignoring time-related features of ntp.c).
+ * Only this file, slip.c, link.c and wheel.c should contain anything
+ * system-dependent (ignoring time-related features of ntp.c).
  */
 
 #if __GNUC__
 /* mostly intended for testing on Linux or modern BSDs */
 #define IS_POSIX	1
+/* we build with -std=c89, so ask for the rest of POSIX and friends */
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE	1
+#endif
 #include <time.h>
+#include <poll.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -29,6 +35,7 @@
 #define B32	int32_t
 #define	MAIN	int
 #define OPEN_RW	O_RDWR
+#define SIGTYPE	void	/* what signal handlers return */
 #else
 /* assume Venix-11 or PRO/VENIX */
 /* #undef IS_POSIX */
@@ -40,6 +47,7 @@
 #define B32	long
 #define MAIN	/* nothing */
 #define	OPEN_RW	2
+#define SIGTYPE	int
 
 #else
 you_should_probably_define_something_here;
@@ -0,0 +1,514 @@
+/* CSLIP header compression for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * This is Van Jacobson TCP/IP header compression (RFC 1144) for the SLIP
+ * driver, which calls it on every frame in and out. It is modeled closely
+ * on the sample implementation in the RFC, but works on byte arrays so
+ * that, like the rest of BASS, it assumes nothing about endianness or
+ * structure packing.
+ *
+ * cslip_crunch() takes an outgoing datagram and, if it can be compressed,
+ * returns a header to send in place of the datagram's own.
+ * cslip_uncrunch() takes a received compressed (or uncompressed-TCP) frame
+ * and rebuilds the datagram in place.
+ * cslip_error() tells the decompressor a frame was lost, so that it can
+ * discard anything that depended on it until the sender resynchronizes.
+ */
+
+#include "compat.h"
+#include "cslip.h"
+#include "slip.h"
+
+/* change mask bits in the first byte of a compressed header */
+#define CS_C		0x40	/* connection number follows */
+#define CS_I		0x20	/* IP ID delta */
+#define CS_P		0x10	/* TCP PSH */
+#define CS_S		0x08	/* sequence number delta */
+#define CS_A		0x04	/* acknowledgement number delta */
+#define CS_W		0x02	/* window delta */
+#define CS_U		0x01	/* urgent pointer */
+/* unlikely combinations reused for common cases */
+#define CS_SPECIAL_I	(CS_S | CS_W | CS_U)	/* echoed interactive */
+#define CS_SPECIAL_D	(CS_S | CS_A | CS_W | CS_U) /* unidirectional data */
+#define CS_SPECIALS	(CS_S | CS_A | CS_W | CS_U)
+
+/* big endian helpers */
+#define CS_GET16(p)	((((B32)(p)[0] & 0xff) << 8) | ((B32)(p)[1] & 0xff))
+
+struct cstate {
+	SCH cs_hdr[CSLIP_HDR];	/* last IP+TCP header sent/received */
+	int cs_hlen;		/* its length, or zero if slot unused */
+};
+
+int cslip_on = CSLIP_MODE;
+
+/* transmit side. cslip_order keeps the slots in most-recently-used order,
+   so the one at the end gets recycled for a new connection. */
+struct cstate cslip_snd[CSLIP_SLOTS];
+int cslip_order[CSLIP_SLOTS];
+int cslip_lastx = -1;
+
+/* receive side. we start out tossing until the sender tells us which
+   connection it means. */
+struct cstate cslip_rcv[CSLIP_SLOTS];
+int cslip_prev = -1;
+int cslip_toss = 1;
+
+/* add a 16-bit increment to a 32-bit big endian value */
+int cslip_bump(v, inc)
+SCH *v;
+B32 inc;
+{
+	B32 w;
+
+	w = (v[3] & 0xff) + (inc & 0xff);
+	v[3] = w & 0xff;
+	w >>= 8;
+	w += (v[2] & 0xff) + ((inc >> 8) & 0xff);
+	v[2] = w & 0xff;
+	w >>= 8;
+	w += (v[1] & 0xff);
+	v[1] = w & 0xff;
+	w >>= 8;
+	w += (v[0] & 0xff);
+	v[0] = w & 0xff;
+	return 1;
+}
+
+/* difference of two 32-bit big endian values. returns zero if it doesn't
+   fit in 16 bits, which means we can't send it compressed. */
+int cslip_diff(newv, oldv, out)
+SCH *newv;
+SCH *oldv;
+B32 *out;
+{
+	B32 hi, lo;
+
+	lo = CS_GET16(newv + 2) - CS_GET16(oldv + 2);
+	hi = CS_GET16(newv) - CS_GET16(oldv);
+	if (lo < 0) {
+		lo += 65536L;
+		hi--;
+	}
+	if (hi & 0xffff)
+		return 0;
+	*out = lo;
+	return 1;
+}
+
+/* encode a delta: 1-255 as one byte, otherwise a zero and two bytes. if
+   zero is set, a zero delta is also sent long (for fields that are sent
+   even when they don't change). returns the bytes used. */
+int cslip_delta(out, n, zero)
+SCH *out;
+B32 n;
+int zero;
+{
+	if (n >= 256 || (zero && !n)) {
+		out[0] = 0;
+		out[1] = (n >> 8) & 0xff;
+		out[2] = n & 0xff;
+		return 3;
+	}
+	out[0] = n & 0xff;
+	return 1;
+}
+
+/* decode a delta at payload[*cp], which must be within size */
+int cslip_fetch(payload, cp, size, out)
+SCH *payload;
+int *cp;
+int size;
+B32 *out;
+{
+	int i = *cp;
+
+	if (i >= size)
+		return 0;
+	if (payload[i]) {
+		*out = payload[i] & 0xff;
+		*cp = i + 1;
+		return 1;
+	}
+	if (i + 3 > size)
+		return 0;
+	*out = CS_GET16(payload + i + 1);
+	*cp = i + 3;
+	return 1;
+}
+
+/* move a transmit slot to the front of the MRU list */
+int cslip_touch(slot)
+int slot;
+{
+	int i, j;
+
+	for(i=0; i<CSLIP_SLOTS; i++) {
+		if (cslip_order[i] == slot)
+			break;
+	}
+	for(j=i; j>0; j--)
+		cslip_order[j] = cslip_order[j-1];
+	cslip_order[0] = slot;
+	return 1;
+}
+
+/* returns the number of header bytes placed in hdr (which should have room
+   for CSLIP_HDR bytes), to be sent instead of the first *skip bytes of the
+   datagram. if it returns zero, send the datagram as is. */
+int cslip_crunch(payload, size, hdr, skip)
+SCH *payload; /* datagram to send */
+int size; /* its length */
+SCH *hdr; /* where the replacement header goes */
+int *skip; /* how much of the datagram the header replaces */
+{
+	int i, j, k, ihl, hlen, slot, changes;
+	B32 deltaS, deltaA, iplen, oiplen;
+	SCH *th, *oip, *oth;
+	SCH seqs[16];
+	struct cstate *cs;
+
+	*skip = 0;
+	if (cslip_on != CSLIP_ON)
+		return 0;
+
+	/* we only do unfragmented TCP */
+	if (size < 40 || payload[9] != 6)
+		return 0;
+	if ((payload[6] & 0x3f) || payload[7])
+		return 0;
+	ihl = (payload[0] & 0x0f) << 2;
+	if (ihl < 20 || size < ihl + 20)
+		return 0;
+	th = payload + ihl;
+	hlen = ihl + (((th[12] >> 4) & 0x0f) << 2);
+	if (hlen > size || hlen > CSLIP_HDR)
+		return 0;
+	/* and only plain ACKs: SYN, FIN and RST always go out whole */
+	if ((th[13] & 0x17) != 0x10)
+		return 0;
+
+	/* first time through, set up the MRU list */
+	if (cslip_lastx < 0) {
+		for(i=0; i<CSLIP_SLOTS; i++)
+			cslip_order[i] = i;
+	}
+
+	/* find the slot for this connection by addresses and ports */
+	slot = -1;
+	for(i=0; i<CSLIP_SLOTS && slot<0; i++) {
+		cs = &cslip_snd[cslip_order[i]];
+		if (!cs->cs_hlen)
+			continue;
+		oip = cs->cs_hdr;
+		oth = oip + ((oip[0] & 0x0f) << 2);
+		for(j=12; j<20; j++) {
+			if (oip[j] != payload[j])
+				break;
+		}
+		if (j < 20)
+			continue;
+		for(j=0; j<4; j++) {
+			if (oth[j] != th[j])
+				break;
+		}
+		if (j == 4)
+			slot = cslip_order[i];
+	}
+	if (slot < 0) {
+		/* new connection, recycle the least recently used slot */
+		slot = cslip_order[CSLIP_SLOTS - 1];
+		goto uncompressed;
+	}
+	cs = &cslip_snd[slot];
+	oip = cs->cs_hdr;
+	oth = oip + ihl;
+
+	/* anything changed we can't express as a delta goes out whole: the
+	   IP version, header length, TOS, fragment bits, TTL and protocol,
+	   the TCP header length, and any options */
+	if (oip[0] != payload[0] || oip[1] != payload[1] ||
+			oip[6] != payload[6] || oip[7] != payload[7] ||
+			oip[8] != payload[8] || oth[12] != th[12])
+		goto uncompressed;
+	for(j=20; j<ihl; j++) {
+		if (oip[j] != payload[j])
+			goto uncompressed;
+	}
+	for(j=ihl+20; j<hlen; j++) {
+		if (oip[j] != payload[j])
+			goto uncompressed;
+	}
+
+	/* now compute the deltas, in the order the RFC sends them */
+	changes = 0;
+	i = 0;
+	if (th[13] & 0x20) {
+		deltaS = CS_GET16(th + 18);
+		i += cslip_delta(seqs + i, deltaS, 1);
+		changes |= CS_U;
+	} else if (th[18] != oth[18] || th[19] != oth[19]) {
+		goto uncompressed;
+	}
+	deltaS = (CS_GET16(th + 14) - CS_GET16(oth + 14)) & 0xffff;
+	if (deltaS) {
+		i += cslip_delta(seqs + i, deltaS, 0);
+		changes |= CS_W;
+	}
+	if (!cslip_diff(th + 8, oth + 8, &deltaA))
+		goto uncompressed;
+	if (deltaA) {
+		i += cslip_delta(seqs + i, deltaA, 0);
+		changes |= CS_A;
+	}
+	if (!cslip_diff(th + 4, oth + 4, &deltaS))
+		goto uncompressed;
+	if (deltaS) {
+		i += cslip_delta(seqs + i, deltaS, 0);
+		changes |= CS_S;
+	}
+
+	iplen = CS_GET16(payload + 2);
+	oiplen = CS_GET16(oip + 2);
+	switch(changes) {
+		case 0:
+			/* nothing changed. if this has data and the last one
+			   didn't, it's probably data following an ACK and it
+			   compresses fine. otherwise it's a retransmission or
+			   a window probe, so send it whole. */
+			if (iplen != oiplen && oiplen == hlen)
+				break;
+			goto uncompressed;
+
+		case CS_SPECIAL_I:
+		case CS_SPECIAL_D:
+			/* the real changes look like a special case */
+			goto uncompressed;
+
+		case CS_S | CS_A:
+			if (deltaS == deltaA && deltaS == oiplen - hlen) {
+				changes = CS_SPECIAL_I;
+				i = 0;
+			}
+			break;
+
+		case CS_S:
+			if (deltaS == oiplen - hlen) {
+				changes = CS_SPECIAL_D;
+				i = 0;
+			}
+			break;
+	}
+	deltaS = (CS_GET16(payload + 4) - CS_GET16(oip + 4)) & 0xffff;
+	if (deltaS != 1) {
+		i += cslip_delta(seqs + i, deltaS, 1);
+		changes |= CS_I;
+	}
+	if (th[13] & 0x08)
+		changes |= CS_P;
+
+	/* remember this header for next time */
+	for(j=0; j<hlen; j++)
+		oip[j] = payload[j];
+	cs->cs_hlen = hlen;
+	cslip_touch(slot);
+
+	/* assemble the compressed header, leaving out the connection number
+	   if it's the same as last time */
+	j = 0;
+	if (cslip_lastx != slot) {
+		cslip_lastx = slot;
+		hdr[j++] = 0x80 | CS_C | changes;
+		hdr[j++] = slot;
+	} else {
+		hdr[j++] = 0x80 | changes;
+	}
+	/* the TCP checksum always goes over as is */
+	hdr[j++] = th[16];
+	hdr[j++] = th[17];
+	for(k=0; k<i; k++)
+		hdr[j++] = seqs[k];
+	*skip = hlen;
+	return j;
+
+uncompressed:
+	/* send the whole header, but with the slot in the protocol field */
+	cs = &cslip_snd[slot];
+	for(j=0; j<hlen; j++)
+		cs->cs_hdr[j] = hdr[j] = payload[j];
+	cs->cs_hlen = hlen;
+	cslip_touch(slot);
+	cslip_lastx = slot;
+	hdr[0] |= 0x70;
+	hdr[9] = slot;
+	*skip = hlen;
+	return hlen;
+}
+
+/* returns the new length of the datagram rebuilt in place from a received
+   frame, or zero if it has to be discarded. the buffer must have room
+   for the full header in place of the compressed one. */
+int cslip_uncrunch(payload, size, room)
+SCH *payload; /* received frame */
+int size; /* its length */
+int room; /* size of the buffer it's in */
+{
+	int i, j, cp, ihl, changes;
+	B32 d;
+	SCH *oip, *th;
+	struct cstate *cs;
+
+	if (size < 1)
+		goto bad;
+	j = payload[0] & 0xff;
+
+	if (!(j & 0x80)) {
+		/* uncompressed TCP. restore the version and protocol and
+		   remember the header in the slot the sender picked. */
+		i = payload[9] & 0xff;
+		if (i >= CSLIP_SLOTS || size < 40)
+			goto bad;
+		payload[0] = j & 0x4f;
+		payload[9] = 6;
+		ihl = (payload[0] & 0x0f) << 2;
+		if (ihl < 20 || size < ihl + 20)
+			goto bad;
+		cp = ihl + (((payload[ihl + 12] >> 4) & 0x0f) << 2);
+		if (cp > size || cp > CSLIP_HDR)
+			goto bad;
+		cs = &cslip_rcv[i];
+		for(j=0; j<cp; j++)
+			cs->cs_hdr[j] = payload[j];
+		cs->cs_hlen = cp;
+		cslip_prev = i;
+		cslip_toss = 0;
+		if (cslip_on == CSLIP_AUTO)
+			cslip_on = CSLIP_ON;
+		return size;
+	}
+
+	/* compressed TCP */
+	cp = 1;
+	changes = j;
+	if (changes & CS_C) {
+		if (cp >= size)
+			goto bad;
+		i = payload[cp++] & 0xff;
+		if (i >= CSLIP_SLOTS)
+			goto bad;
+		cslip_prev = i;
+		cslip_toss = 0;
+	} else if (cslip_toss) {
+		/* still waiting for the sender to resynchronize */
+		return 0;
+	}
+	cs = &cslip_rcv[cslip_prev];
+	if (!cs->cs_hlen)
+		goto bad;
+	oip = cs->cs_hdr;
+	ihl = (oip[0] & 0x0f) << 2;
+	th = oip + ihl;
+
+	if (cp + 2 > size)
+		goto bad;
+	th[16] = payload[cp++];
+	th[17] = payload[cp++];
+	if (changes & CS_P)
+		th[13] |= 0x08;
+	else
+		th[13] &= ~0x08;
+
+	switch(changes & CS_SPECIALS) {
+		case CS_SPECIAL_I:
+			d = CS_GET16(oip + 2) - cs->cs_hlen;
+			cslip_bump(th + 8, d);
+			cslip_bump(th + 4, d);
+			break;
+
+		case CS_SPECIAL_D:
+			d = CS_GET16(oip + 2) - cs->cs_hlen;
+			cslip_bump(th + 4, d);
+			break;
+
+		default:
+			if (changes & CS_U) {
+				th[13] |= 0x20;
+				if (!cslip_fetch(payload, &cp, size, &d))
+					goto bad;
+				th[18] = (d >> 8) & 0xff;
+				th[19] = d & 0xff;
+			} else {
+				th[13] &= ~0x20;
+			}
+			if (changes & CS_W) {
+				if (!cslip_fetch(payload, &cp, size, &d))
+					goto bad;
+				d += CS_GET16(th + 14);
+				th[14] = (d >> 8) & 0xff;
+				th[15] = d & 0xff;
+			}
+			if (changes & CS_A) {
+				if (!cslip_fetch(payload, &cp, size, &d))
+					goto bad;
+				cslip_bump(th + 8, d);
+			}
+			if (changes & CS_S) {
+				if (!cslip_fetch(payload, &cp, size, &d))
+					goto bad;
+				cslip_bump(th + 4, d);
+			}
+			break;
+	}
+	if (changes & CS_I) {
+		if (!cslip_fetch(payload, &cp, size, &d))
+			goto bad;
+	} else {
+		d = 1;
+	}
+	d += CS_GET16(oip + 4);
+	oip[4] = (d >> 8) & 0xff;
+	oip[5] = d & 0xff;
+
+	/* everything from cp on is data. slide it into place behind the
+	   rebuilt header. */
+	j = size - cp;
+	i = cs->cs_hlen + j;
+	if (i > room)
+		goto bad;
+	if (cs->cs_hlen > cp) {
+		for(j=size-1; j>=cp; j--)
+			payload[j + cs->cs_hlen - cp] = payload[j];
+	} else if (cs->cs_hlen < cp) {
+		for(j=cp; j<size; j++)
+			payload[j + cs->cs_hlen - cp] = payload[j];
+	}
+
+	/* fix up the IP length and checksum */
+	oip[2] = (i >> 8) & 0xff;
+	oip[3] = i & 0xff;
+	oip[10] = 0;
+	oip[11] = 0;
+	d = slip_sum(oip, ihl);
+	oip[10] = (d >> 8) & 0xff;
+	oip[11] = d & 0xff;
+	for(j=0; j<cs->cs_hlen; j++)
+		payload[j] = oip[j];
+
+	if (cslip_on == CSLIP_AUTO)
+		cslip_on = CSLIP_ON;
+	return i;
+
+bad:
+	cslip_toss = 1;
+	return 0;
+}
+
+/* a frame was lost or mangled, so toss compressed frames until the sender
+   names a connection again */
+int cslip_error()
+{
+	cslip_toss = 1;
+	return 0;
+}
@@ -0,0 +1,39 @@
+#if NO_CSLIP
+/* built without it: nothing is compressed, and compressed frames are
+   thrown away */
+#define cslip_crunch(p, s, h, k)	(*(k) = 0)
+#define cslip_uncrunch(p, s, r)		0
+#define cslip_error()			((void)0)
+#else
+#if __GNUC__
+int cslip_crunch(SCH *payload, int size, SCH *hdr, int *skip);
+int cslip_uncrunch(SCH *payload, int size, int room);
+#else
+int cslip_crunch();
+int cslip_uncrunch();
+#endif
+int cslip_error();
+#endif
+
+/* compression modes for cslip_on. in auto mode we only start compressing
+   once the other side has sent us a compressed frame, so it is always safe
+   to leave on with a peer that doesn't do CSLIP. */
+#define CSLIP_OFF	0
+#define CSLIP_ON	1
+#define CSLIP_AUTO	2
+
+#ifndef CSLIP_MODE
+#define CSLIP_MODE	CSLIP_AUTO
+#endif
+
+/* connection slots. RFC 1144 peers almost universally use 16, and we must
+   be able to receive on any slot they pick. */
+#ifndef CSLIP_SLOTS
+#define CSLIP_SLOTS	16
+#endif
+/* largest IP+TCP header we'll remember (RFC 1144 uses 128) */
+#ifndef CSLIP_HDR
+#define CSLIP_HDR	128
+#endif
+
+extern int cslip_on;
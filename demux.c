@@ -0,0 +1,263 @@
+/* Receive demultiplexer for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * Every client used to call slip_slurp() itself and throw away anything
+ * that wasn't for it, so if two things were going on at once (say, a DNS
+ * lookup while a TCP connection was open), whatever the one waiting didn't
+ * want was lost and the other side had to send it again. Instead, each
+ * datagram is sorted once by protocol and port (our port, that is: the
+ * destination port for TCP and UDP, or the identifier of an ICMP echo
+ * reply), and if it's not for whoever is waiting but someone else has
+ * asked for it, it's held until they come for it.
+ *
+ * dmx_want() says you want datagrams for a protocol and port, and
+ * dmx_done() says you don't any more, dropping any still held. They
+ * nest, so a connection and something that waits on its behalf (like
+ * tcp_twiddle()) can both ask.
+ * dmx_recv() is slip_slurp() for one protocol and port: it returns the
+ * oldest held datagram for them, if any, or else waits for one, holding
+ * on to anything else that someone wants. Datagrams nobody wants are
+ * dropped as they always were. Held datagrams are kept in buffers from
+ * the pool (see pbuf.c); if too many are held or the pool runs dry, the
+ * oldest goes, and dmx_lost counts it.
+ */
+
+#include "compat.h"
+#include "slip.h"
+#include "demux.h"
+#include "pbuf.h"
+#include "trace.h"
+
+/* a datagram we're holding on to */
+struct dgram {
+	SCH *dg_data;	/* NULL if this slot is free */
+	int dg_size;
+	int dg_proto;
+	B32 dg_port;
+	B32 dg_hsum;	/* slip_hsum and slip_psum, as they were */
+	B32 dg_psum;
+	B32 dg_age;	/* to find the oldest */
+};
+
+/* a (protocol, port) someone wants */
+struct want {
+	int wt_proto;
+	B32 wt_port;
+	int wt_count;	/* 0 if this slot is free */
+};
+
+struct dgram dmx_q[DMX_SLOTS];
+struct want dmx_wants[DMX_WANTS];
+B32 dmx_age = 0;
+int dmx_lost = 0;
+
+/* work out a datagram's protocol and port */
+int dmx_sort(payload, size, port)
+SCH *payload;
+int size;
+B32 *port;
+{
+	int hlen, proto;
+
+	hlen = (payload[0] & 0x0f) << 2;
+	proto = payload[9] & 0xff;
+	*port = 0;
+	if (proto == DMX_TCP || proto == DMX_UDP) {
+		if (size >= hlen + 4) {
+			*port = payload[hlen + 2] & 0xff;
+			*port = (*port << 8) | (payload[hlen + 3] & 0xff);
+		}
+	} else if (proto == DMX_ICMP) {
+		/* echo replies carry the identifier of the request */
+		if (size >= hlen + 8 && payload[hlen] == 0) {
+			*port = payload[hlen + 4] & 0xff;
+			*port = (*port << 8) | (payload[hlen + 5] & 0xff);
+		}
+	}
+	return proto;
+}
+
+/* find who wants a protocol and port, or -1 */
+int dmx_who(proto, port)
+int proto;
+B32 port;
+{
+	int i;
+
+	for(i=0; i<DMX_WANTS; i++) {
+		if (dmx_wants[i].wt_count && dmx_wants[i].wt_proto == proto &&
+				dmx_wants[i].wt_port == port)
+			return i;
+	}
+	return -1;
+}
+
+int dmx_want(proto, port)
+int proto;
+B32 port;
+{
+	int i;
+
+	i = dmx_who(proto, port);
+	if (i < 0) {
+		for(i=0; i<DMX_WANTS && dmx_wants[i].wt_count; i++);
+		if (i == DMX_WANTS)
+			return 0;
+		dmx_wants[i].wt_proto = proto;
+		dmx_wants[i].wt_port = port;
+	}
+	dmx_wants[i].wt_count++;
+	return 1;
+}
+
+int dmx_done(proto, port)
+int proto;
+B32 port;
+{
+	int i;
+
+	i = dmx_who(proto, port);
+	if (i < 0)
+		return 0;
+	if (--dmx_wants[i].wt_count)
+		return 1;
+	/* nobody is going to come for these now */
+	for(i=0; i<DMX_SLOTS; i++) {
+		if (dmx_q[i].dg_data && dmx_q[i].dg_proto == proto &&
+				dmx_q[i].dg_port == port) {
+			pb_free(dmx_q[i].dg_data);
+			dmx_q[i].dg_data = NULL;
+		}
+	}
+	return 1;
+}
+
+/* drop the oldest datagram we're holding to make room. returns its slot,
+   or -1 if we aren't holding any. */
+int dmx_evict()
+{
+	int i, j;
+
+	j = -1;
+	for(i=0; i<DMX_SLOTS; i++) {
+		if (dmx_q[i].dg_data &&
+				(j < 0 || dmx_q[i].dg_age < dmx_q[j].dg_age))
+			j = i;
+	}
+	if (j < 0)
+		return -1;
+	TRACE(TR_EVICT, dmx_q[j].dg_proto, dmx_q[j].dg_port);
+	pb_free(dmx_q[j].dg_data);
+	dmx_q[j].dg_data = NULL;
+	dmx_lost++;
+	return j;
+}
+
+/* hold on to a datagram for someone else, if anyone wants it */
+int dmx_keep(payload, size, proto, port)
+SCH *payload;
+int size;
+int proto;
+B32 port;
+{
+	int i, j;
+	struct dgram *d;
+
+	if (dmx_who(proto, port) < 0) {
+		TRACE(TR_STRAY, proto, port);
+		return 0;
+	}
+
+	if (size > PB_SIZE) {
+		dmx_lost++;
+		return 0;
+	}
+
+	/* find a free slot, or else make one out of the oldest */
+	for(i=0; i<DMX_SLOTS && dmx_q[i].dg_data; i++);
+	if (i == DMX_SLOTS)
+		i = dmx_evict();
+	d = &dmx_q[i];
+
+	/* and a buffer for it, likewise */
+	while (!(d->dg_data = pb_get())) {
+		if (dmx_evict() < 0) {
+			dmx_lost++;
+			return 0;
+		}
+	}
+	for(j=0; j<size; j++)
+		d->dg_data[j] = payload[j];
+	d->dg_size = size;
+	d->dg_proto = proto;
+	d->dg_port = port;
+	d->dg_hsum = slip_hsum;
+	d->dg_psum = slip_psum;
+	d->dg_age = dmx_age++;
+	return 1;
+}
+
+int dmx_recv(payload, size, proto, port)
+SCH *payload; /* buffer for the datagram */
+int size; /* how big it is */
+int proto; /* protocol we want */
+B32 port; /* our port, or ICMP echo identifier */
+{
+	int i, j, n, p;
+	B32 q;
+	struct dgram *d;
+
+	/* anything we already have, oldest first */
+	for(;;) {
+		j = -1;
+		for(i=0; i<DMX_SLOTS; i++) {
+			if (dmx_q[i].dg_data && dmx_q[i].dg_proto == proto &&
+					dmx_q[i].dg_port == port &&
+					(j < 0 || dmx_q[i].dg_age <
+						dmx_q[j].dg_age))
+				j = i;
+		}
+		if (j < 0)
+			break;
+		d = &dmx_q[j];
+		n = d->dg_size;
+		/* the buffer should always be big enough, but if it isn't,
+		   there's nothing to do but lose it */
+		if (n < size) {
+			for(i=0; i<n; i++)
+				payload[i] = d->dg_data[i];
+			slip_hsum = d->dg_hsum;
+			slip_psum = d->dg_psum;
+			/* and none of it went to the sink */
+			if (slip_sink)
+				slip_sink->sk_got = 0;
+		} else {
+			dmx_lost++;
+			n = 0;
+		}
+		pb_free(d->dg_data);
+		d->dg_data = NULL;
+		if (n)
+			return n;
+	}
+
+	/* otherwise, wait for it */
+	for(;;) {
+		n = slip_slurp(payload, size);
+		if (!n)
+			return 0;
+		p = dmx_sort(payload, n, &q);
+		if (p == proto && q == port)
+			return n;
+		/* if its data went to the sink (see slip_divert()), we only
+		   have half of it */
+		if (slip_sink && slip_sink->sk_got) {
+			slip_sink->sk_got = 0;
+			dmx_lost++;
+			continue;
+		}
+		dmx_keep(payload, n, p, q);
+	}
+}
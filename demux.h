@@ -0,0 +1,25 @@
+#if __GNUC__
+int dmx_want(int proto, B32 port);
+int dmx_done(int proto, B32 port);
+int dmx_recv(SCH *payload, int size, int proto, B32 port);
+#else
+int dmx_want();
+int dmx_done();
+int dmx_recv();
+#endif
+
+extern int dmx_lost;
+
+/* how many datagrams we hold for consumers that aren't waiting right now,
+   and how many (protocol, port) pairs can be wanted at once */
+#ifndef DMX_SLOTS
+#define DMX_SLOTS	8
+#endif
+#ifndef DMX_WANTS
+#define DMX_WANTS	8
+#endif
+
+/* protocols, as in the IP header */
+#define DMX_ICMP	1
+#define DMX_TCP		6
+#define DMX_UDP		17
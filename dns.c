@@ -12,9 +12,18 @@
 #include "compat.h"
 #include "dns.h"
 #include "slip.h"
-
-/* add some paddin' */
+#include "udp.h"
+#include "wheel.h"
+#include "demux.h"
+#include "pbuf.h"
+#include "trace.h"
+
+/* add some paddin', if a pool buffer has room for it */
+#if PB_SIZE < 640
+#define PACKET_SIZE PB_SIZE
+#else
 #define PACKET_SIZE 640
+#endif
 
 /* returns number of answers, or 0 if failed/NXDOMAIN */
 int dns_dissolve(name, src, dst, answer)
@@ -24,10 +33,10 @@ SCH *dst; /* IPv4 of server (must be able to handle recursive queries) */
 SCH *answer; /* where we put the response, or an error code */
 {
 	B16 size, oldsize;
-	/* RFC 6864 indicates that pretty much nothing relies on the
-         * uniqueness of the IPv4 ID field anymore. */
-	B16 checksum;
 	int j, k, count, last, answers, type, class;
+	B32 port;
+	struct timer t;
+	struct udb ud;
 	SCH *i;
 	SCH *packet;
 	SCH trans_l, sport_l;
@@ -35,22 +44,14 @@ SCH *answer; /* where we put the response, or an error code */
 
 	/* ass-U-me SLIP has been initialized */
 
-	/* we clear the packet manually anyway, so don't bother with calloc */
-	packet = malloc(PACKET_SIZE); /* maximum size for UDP DNS */
+	/* everything we send gets filled in, so it needn't be clear */
+	packet = pb_get(); /* we use PACKET_SIZE of it, the most UDP DNS needs */
 	if (!packet) {
 		answer[0] = DNS_NOMEM;
 		return 0;
 	}
-	slip_splat(packet, PACKET_SIZE);
-
-	/***** IP header *****/
-	/* version and length of IP header */
-	packet[0] = 0x45;	/* IPv4, 5 32-bit ints == 20 bytes */
-
-	/* TOS as DSCP and ECN: just use zero */
-	packet[1] = 0x00;
 
-	/* length of complete packet and payload, big endian */
+	/* length of complete packet and payload */
 	size = 20 + /* IP header */
 		8 + /* UDP header */
 		2 + /* DNS transaction ID */
@@ -61,63 +62,13 @@ SCH *answer; /* where we put the response, or an error code */
 	/* is redonkulous? is redonkulous. you try again. */
 	if (size > 511) {
 		answer[0] = DNS_BIG_QUESTION;
-		free(packet);
+		pb_free(packet);
 		return 0;
 	}
 
-	packet[2] = (size >> 8) & 0xff;
-	packet[3] = (size & 0x00ff);
-
-	/* identification, big endian (see above) */
-	packet[4] = rand() & 0xff;
-	packet[5] = rand() & 0xff;
-
-	/* fragmentation: none, not allowed */
-	packet[6] = 0;
-	packet[7] = 0;
-
-	/* come back to the rest at the end */
-
-	/***** UDP pseudo-header *****/
-	/* we put this here so we can compute the checksum early, and then
-           fill in our IP information and checksum that at the end. */
-
-	/* source IP */
-	packet[8] = src[0];
-	packet[9] = src[1];
-	packet[10] = src[2];
-	packet[11] = src[3];
-
-	/* destination IP */
-	packet[12] = dst[0];
-	packet[13] = dst[1];
-	packet[14] = dst[2];
-	packet[15] = dst[3];
-
-	/* explicit zero */
-	packet[16] = 0;
-	/* protocol, always 17 for UDP */
-	packet[17] = 17;
-	/* length,  minus IP header */
-	packet[18] = ((size - 20) >> 8) & 0xff;
-	packet[19] = ((size - 20) & 0x00ff);
-
-	/***** UDP payload *****/
 	/* source port. don't care, but make sure it matches */
 	sport_h = rand() & 0xff;
-	packet[20] = sport_h;
 	sport_l = rand() & 0xff;
-	packet[21] = sport_l;
-
-	/* destination port, big endian */
-	packet[22] = 0;
-	packet[23] = 53;
-
-	/* length again, minus IP header */
-	packet[24] = ((size - 20) >> 8) & 0xff;
-	packet[25] = ((size - 20) & 0x00ff);
-
-	/* we'll come back to the checksum at the end */
 
 	/***** DNS payload *****/
 	/* transaction ID (random, but we check it) */
@@ -168,113 +119,62 @@ SCH *answer; /* where we put the response, or an error code */
 	/* oops, assertion failed */
 	if (j != size) {
 		answer[0] = DNS_QUESTION_ERROR;
-		free(packet);
+		pb_free(packet);
 		return 0;
 	}
 
-	/* compute UDP checksum (with checksum field = 0) */
-	/* including pseudo header */
-	/* pad null in checksum if not even 16-bit boundary */
-	if (size & 1) {
-		/* add null, incorporate into checksum, keep size */
-		packet[j++] = 0;
-		checksum = slip_sum(packet + 8, size - 7);
-	} else {
-		checksum = slip_sum(packet + 8, size - 8);
-	}
-	packet[26] = (checksum >> 8) & 0xff;
-	packet[27] = (checksum & 0x00ff); 
-
-	/***** finish IP packet ****/
-	/* TTL of 64 */
-	packet[8] = 64;
-	
-	/* protocol is UDP */
-	packet[9] = 17;
-
-	/* zero out checksum */
-	packet[10] = 0;
-	packet[11] = 0;
-
-	/* source IP */
-	packet[12] = src[0];
-	packet[13] = src[1];
-	packet[14] = src[2];
-	packet[15] = src[3];
-
-	/* destination IP */
-	packet[16] = dst[0];
-	packet[17] = dst[1];
-	packet[18] = dst[2];
-	packet[19] = dst[3];
-
-	/* compute IP checksum (with checksum field = 0) */
-	checksum = slip_sum(packet, 20);
-	packet[10] = (checksum >> 8) & 0xff;
-	packet[11] = (checksum & 0x00ff); 
+	/* the IP and UDP headers go in front */
+	udp_prime(&ud, src, dst, 53, sport_h, sport_l);
+	size = udp_build(&ud, packet, size - 28);
+	/* hold on to the answer if it comes while someone else is
+	   waiting */
+	port = sport_h & 0xff;
+	port = (port << 8) | (sport_l & 0xff);
+	dmx_want(DMX_UDP, port);
 	if(!slip_ship(packet, size)) {
+		dmx_done(DMX_UDP, port);
 		answer[0] = DNS_SLIP_ERROR;
-		free(packet);
+		pb_free(packet);
 		return 0;
 	}
 	oldsize = size;
 
+	/* it's UDP, so if the server doesn't answer, let the caller
+	   decide whether to ask again */
+	wheel_arm(&t, (B32)DNS_WAIT, 0, 0);
 	for(;;) {
-		size = slip_slurp(packet, PACKET_SIZE);
-		if (!size) { /* something is wrong */
-			answer[0] = DNS_SLIP_ERROR;
-			free(packet);
+		size = dmx_recv(packet, PACKET_SIZE, DMX_UDP, port);
+		/* the alarm may be for some other timer */
+		if (!size && slip_fault == SLIP_TIMEOUT && t.tw_live)
+			continue;
+		if (!size) { /* something is wrong, or no answer in time */
+			answer[0] = (slip_fault == SLIP_TIMEOUT) ?
+				DNS_TIMEOUT : DNS_SLIP_ERROR;
+			if (answer[0] == DNS_TIMEOUT)
+				TRACE(TR_TIMEOUT, 1, 0);
+			wheel_drop(&t);
+			dmx_done(DMX_UDP, port);
+			pb_free(packet);
 			return 0;
 		}
 
-		j = packet[9]; /* hold for a moment */
-
-		/* verify its checksum by reconstructing the pseudo-header */
-		/* source IP */
-		packet[8] = packet[12];
-		packet[9] = packet[13];
-		packet[10] = packet[14];
-		packet[11] = packet[15];
-
-		/* destination IP */
-		packet[12] = packet[16];
-		packet[13] = packet[17];
-		packet[14] = packet[18];
-		packet[15] = packet[19];
-
-		/* zero, UDP, packet length */
-		packet[16] = 0;
-		packet[17] = 17;
-		packet[18] = packet[24];
-		packet[19] = packet[25];
-
-		/* pad the packet to an even 16-bits per RFC 768 */
-		if (size & 1) {
-			/* add a null, incorporate null into checksum */
-			packet[size] = 0;
-			checksum = slip_sum(packet + 8, size - 7);
-		} else {
-			checksum = slip_sum(packet + 8, size - 8);
-		}
-		if (checksum) { /* RFC 1071 */
+		/* it's UDP to our port, or we wouldn't have it */
+		/* verify its checksum */
+		if (!slip_valid(packet, size)) {
+			TRACE(TR_CSUM, 17, size);
 			answer[0] = DNS_BAD_ANSWER;
-			free(packet);
+			wheel_drop(&t);
+			dmx_done(DMX_UDP, port);
+			pb_free(packet);
 			return 0;
 			/* we don't wait again, the packet was mangled but
 				because it's UDP it will not be re-sent.
 				see if the caller wants to try again. */
 		}
 
-		/* fast kickouts */
-		/* reject non-UDP */
-		if (j != 17)
-			continue;
 		/* reject non-DNS replies */
 		if (!(packet[30] & 128))
 			continue;
-		/* reject replies that aren't to our pseudoport */
-		if (packet[22] != sport_h || packet[23] != sport_l)
-			continue;
 		/* reject replies that aren't to our query */
 		if ((packet[28] != trans_h) || (packet[29] != trans_l))
 			continue;
@@ -282,6 +182,8 @@ SCH *answer; /* where we put the response, or an error code */
 		/* we have a packet that purports to be our reply */
 		break;
 	}
+	wheel_drop(&t);
+	dmx_done(DMX_UDP, port);
 
 	/***** process the reply *****/
 
@@ -289,12 +191,6 @@ SCH *answer; /* where we put the response, or an error code */
 
 	answers = (packet[34] << 8) + packet[35];
 	/* the reply follows the question, so start from that offset */
-#if DEBUG
-for(j=0;j<size;j++) { if(j>=oldsize)
-	fprintf(stderr, "/%02x ", (unsigned int)(packet[j] & 0xff));
-	else fprintf(stderr, " %02x ", (unsigned int)(packet[j] & 0xff)); } 
-fprintf(stderr, "\n");
-#endif
 	/* scan ahead until we get to the first record */
 	for(j=oldsize;j<size;j++) {
 		k = packet[j] & 0xff;
@@ -302,20 +198,20 @@ fprintf(stderr, "\n");
 	}
 	if (j == size) {
 		answer[0] = DNS_NO_ANSWERS;
-		free(packet);
+		pb_free(packet);
 		return 0;
 	}
 	for(;j<size;answers--) {
 		k = packet[j] & 0xff;
 		if (!answers) {
 			answer[0] = DNS_NO_ANSWERS;
-			free(packet);
+			pb_free(packet);
 			return 0; /* we don't use the other sections */
 		}
 		k = packet[j] & 0xff;
 		if (k != 192) {
 			answer[0] = DNS_ANSWER_ERROR;
-			free(packet);
+			pb_free(packet);
 			return 0; /* this isn't a DNS answer section */
 		}
 		type = packet[j+3] & 0xff;
@@ -336,18 +232,13 @@ fprintf(stderr, "\n");
 		answer[1] = packet[j+13];
 		answer[2] = packet[j+14];
 		answer[3] = packet[j+15];
-#if DEBUG
-fprintf(stderr, "%d.%d.%d.%d\n", (unsigned int)(answer[0] & 0xff),
-	(unsigned int)(answer[1] & 0xff),
-	(unsigned int)(answer[2] & 0xff),
-	(unsigned int)(answer[3] & 0xff));
-#endif
-		free(packet);
+		TRACE(TR_ANSWER, answers, trace_word(answer));
+		pb_free(packet);
 		return answers; /* alternatives may exist */
 	}
 
 	/* there are no answers, only questions */
 	answer[0] = DNS_NO_ANSWERS;
-	free(packet);
+	pb_free(packet);
 	return 0;
 }
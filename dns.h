@@ -11,4 +11,10 @@ int dns_dissolve();
 #define DNS_NO_ANSWERS		5
 #define DNS_ANSWER_ERROR	6
 #define DNS_NOMEM		7
+#define DNS_TIMEOUT		8
+
+/* how long we wait for the server, in ms */
+#ifndef DNS_WAIT
+#define DNS_WAIT		5000
+#endif
 
@@ -0,0 +1,436 @@
+/* Link backends for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * This is what the SLIP driver actually reads and writes. Normally that's
+ * a serial port, but for testing it's handy to be able to talk to a peer
+ * on the same machine without a null modem, so the device in the link
+ * specification (see slip_config()) can also be one of these:
+ *
+ * stdio	standard input and output.
+ * pty		a new pseudo-terminal; the name of the other end is printed
+ *		on standard error, so you can point a SLIP server at it.
+ * pair=cmd	a socketpair, the other end of which is the standard input
+ *		and output of cmd, run with /bin/sh. cmd can't contain
+ *		commas.
+ * udp=[lport:]host:port
+ *		SLIP bytes carried in UDP datagrams to and from host:port
+ *		(numeric IPv4 only), optionally from local port lport.
+ * replay=file	the datagrams in a pcap file (see pcap.c), as fast as we
+ *		can take them, as if they had come in over the line. what
+ *		we send is thrown away. the link fails at the end of the
+ *		file. not there if built with NO_PCAP.
+ *
+ * Everything but stdio and serial ports is POSIX-only.
+ *
+ * link_open() opens the link named by a device specification and sets
+ * link_rfd and link_wfd to the descriptors to wait on for reading and
+ * writing. link_read() and link_write() work like read() and write(), and
+ * link_close() closes it again.
+ *
+ * Like slip.c, this is system-dependent.
+ */
+
+#if __GNUC__
+/* for the pty functions */
+#define _XOPEN_SOURCE	700
+#endif
+#include "compat.h"
+#include "link.h"
+#include "slip.h"
+#include "pcap.h"
+
+#if IS_POSIX
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+int link_rfd = -1;
+int link_wfd = -1;
+struct link *link_cur = 0;
+
+#if IS_POSIX
+int link_hold = -1;	/* our own hold on the far end of a pty */
+int link_child = -1;	/* process on the far end of a pair */
+#endif
+
+/* plain descriptors */
+int link_fread(buf, len)
+SCH *buf;
+int len;
+{
+	return read(link_rfd, buf, len);
+}
+
+int link_fwrite(buf, len)
+SCH *buf;
+int len;
+{
+	return write(link_wfd, buf, len);
+}
+
+int link_fclose()
+{
+	close(link_rfd); /* ignore return code */
+	if (link_wfd != link_rfd)
+		close(link_wfd);
+	return 1;
+}
+
+/* a serial port */
+int link_serial(dev)
+char *dev;
+{
+#if IS_POSIX
+	link_rfd = open(dev, O_RDWR | O_NOCTTY);
+#else
+	link_rfd = open(dev, OPEN_RW);
+#endif
+	if (link_rfd < 0) {
+		perror("slip_setup failed: open");
+		return 0;
+	}
+	link_wfd = link_rfd;
+	return 1;
+}
+
+/* standard input and output. these aren't ours to close. */
+int link_stdio(arg)
+char *arg;
+{
+	link_rfd = 0;
+	link_wfd = 1;
+	return 1;
+}
+
+int link_snub()
+{
+	return 1;
+}
+
+#if IS_POSIX
+/* a pseudo-terminal. we hold the far end open ourselves, or reads would
+   fail until something else opens it (and after it closes it). */
+int link_pty(arg)
+char *arg;
+{
+	char *name;
+
+	link_rfd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (link_rfd < 0) {
+		perror("slip_setup failed: posix_openpt");
+		return 0;
+	}
+	if (grantpt(link_rfd) || unlockpt(link_rfd) ||
+			!(name = ptsname(link_rfd))) {
+		perror("slip_setup failed: pty");
+		close(link_rfd);
+		return 0;
+	}
+	link_hold = open(name, O_RDWR | O_NOCTTY);
+	if (link_hold < 0) {
+		perror("slip_setup failed: open pty");
+		close(link_rfd);
+		return 0;
+	}
+	link_wfd = link_rfd;
+	fprintf(stderr, "slip: pty is %s\n", name);
+	return 1;
+}
+
+int link_tclose()
+{
+	close(link_rfd);
+	close(link_hold);
+	link_hold = -1;
+	return 1;
+}
+
+/* a socketpair with a command on the other end */
+int link_pair(cmd)
+char *cmd;
+{
+	int sv[2];
+
+	if (!*cmd) {
+		fprintf(stderr, "slip: no command for pair\n");
+		return 0;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		perror("slip_setup failed: socketpair");
+		return 0;
+	}
+	fflush(stdout);
+	fflush(stderr);
+	link_child = fork();
+	if (link_child < 0) {
+		perror("slip_setup failed: fork");
+		close(sv[0]);
+		close(sv[1]);
+		return 0;
+	}
+	if (!link_child) {
+		close(sv[0]);
+		dup2(sv[1], 0);
+		dup2(sv[1], 1);
+		if (sv[1] > 1)
+			close(sv[1]);
+		execl("/bin/sh", "sh", "-c", cmd, (char *)0);
+		perror("slip_setup failed: exec");
+		_exit(127);
+	}
+	close(sv[1]);
+	link_rfd = sv[0];
+	link_wfd = sv[0];
+	return 1;
+}
+
+/* don't let a peer that goes away take us with it */
+int link_pwrite(buf, len)
+SCH *buf;
+int len;
+{
+	return send(link_wfd, buf, len, MSG_NOSIGNAL);
+}
+
+int link_pclose()
+{
+	close(link_rfd);
+	if (link_child > 0) {
+		kill(link_child, SIGTERM);
+		waitpid(link_child, (int *)0, 0);
+	}
+	link_child = -1;
+	return 1;
+}
+
+/* SLIP over UDP */
+int link_udp(arg)
+char *arg;
+{
+	struct sockaddr_in sin;
+	char *p, *q;
+	int lport, port;
+
+	lport = 0;
+	/* two colons means a local port first */
+	for(p=arg; *p && *p != ':'; p++);
+	for(q=(*p) ? p+1 : p; *q && *q != ':'; q++);
+	if (*q) {
+		lport = atoi(arg);
+		arg = p + 1;
+		p = q;
+	}
+	if (!*p || !(port = atoi(p + 1)) || port > 65535 || lport > 65535) {
+		fprintf(stderr, "slip: bad udp address\n");
+		return 0;
+	}
+	*p = 0;
+
+	link_rfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (link_rfd < 0) {
+		perror("slip_setup failed: socket");
+		*p = ':';
+		return 0;
+	}
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	if (lport) {
+		sin.sin_addr.s_addr = htonl(INADDR_ANY);
+		sin.sin_port = htons(lport);
+		if (bind(link_rfd, (struct sockaddr *)&sin, sizeof(sin))) {
+			perror("slip_setup failed: bind");
+			close(link_rfd);
+			*p = ':';
+			return 0;
+		}
+	}
+	sin.sin_addr.s_addr = inet_addr(arg);
+	sin.sin_port = htons(port);
+	if (sin.sin_addr.s_addr == htonl(INADDR_NONE) ||
+			connect(link_rfd, (struct sockaddr *)&sin,
+				sizeof(sin))) {
+		perror("slip_setup failed: udp");
+		close(link_rfd);
+		*p = ':';
+		return 0;
+	}
+	*p = ':';
+	link_wfd = link_rfd;
+	return 1;
+}
+
+/* if nobody is listening yet, we get told so on the next read. that's
+   no reason to give up; treat it as nothing to read. */
+int link_uread(buf, len)
+SCH *buf;
+int len;
+{
+	int i;
+
+	i = recv(link_rfd, buf, len, 0);
+	if (i < 0 && errno == ECONNREFUSED)
+		errno = EAGAIN;
+	return i;
+}
+
+int link_uwrite(buf, len)
+SCH *buf;
+int len;
+{
+	int i;
+
+	i = send(link_wfd, buf, len, 0);
+	if (i < 0 && errno == ECONNREFUSED) /* same deal; just drop it */
+		return len;
+	return i;
+}
+#endif
+
+#if !NO_PCAP
+/* replaying a capture. we SLIP-encode each datagram into a buffer and
+   hand it out from there. */
+#define LINK_PLAY	1536
+SCH link_pbuf[LINK_PLAY];	/* datagram */
+SCH link_pslip[LINK_PLAY * 2 + 2];	/* and SLIP-encoded */
+int link_phead = 0;
+int link_ptail = 0;
+
+int link_replay(path)
+char *path;
+{
+	if (!cap_play(path))
+		return 0;
+	/* it's a file, so it is always ready to read. we never really
+	   write to it, so it's always ready for that too. */
+	link_rfd = fileno(cap_in);
+	link_wfd = link_rfd;
+	link_phead = 0;
+	link_ptail = 0;
+	return 1;
+}
+
+int link_rread(buf, len)
+SCH *buf;
+int len;
+{
+	int i, j, c;
+
+	if (link_phead == link_ptail) {
+		i = cap_read(link_pbuf, LINK_PLAY);
+		if (!i)
+			return 0; /* as good as EOF */
+		link_phead = 0;
+		link_ptail = 0;
+		link_pslip[link_ptail++] = 0xc0;
+		for(j=0; j<i; j++) {
+			c = link_pbuf[j] & 0xff;
+			if (c == 0xc0) {
+				link_pslip[link_ptail++] = 0xdb;
+				link_pslip[link_ptail++] = 0xdc;
+			} else if (c == 0xdb) {
+				link_pslip[link_ptail++] = 0xdb;
+				link_pslip[link_ptail++] = 0xdd;
+			} else
+				link_pslip[link_ptail++] = c;
+		}
+		link_pslip[link_ptail++] = 0xc0;
+	}
+	for(i=0; i<len && link_phead<link_ptail; i++)
+		buf[i] = link_pslip[link_phead++];
+	return i;
+}
+
+int link_rwrite(buf, len)
+SCH *buf;
+int len;
+{
+	return len;
+}
+
+int link_rclose()
+{
+	cap_stop();
+	return 1;
+}
+#endif
+
+struct link link_table[] = {
+	{ "stdio", link_stdio, link_fread, link_fwrite, link_snub,
+		LINK_SHARED },
+#if !NO_PCAP
+	{ "replay=", link_replay, link_rread, link_rwrite, link_rclose,
+		LINK_SHARED },
+#endif
+#if IS_POSIX
+	{ "pty", link_pty, link_fread, link_fwrite, link_tclose,
+		LINK_TTY },
+	{ "pair=", link_pair, link_fread, link_pwrite, link_pclose, 0 },
+	{ "udp=", link_udp, link_uread, link_uwrite, link_fclose, 0 },
+#endif
+	/* anything else */
+	{ (char *)0, link_serial, link_fread, link_fwrite, link_fclose,
+		LINK_TTY }
+};
+
+/* open the link named by spec, a device from a link specification */
+int link_open(spec)
+char *spec;
+{
+	struct link *l;
+	char *p, *q;
+
+	if (link_cur)
+		link_close();
+	for(l=link_table; l->ln_name; l++) {
+		for(p=spec, q=l->ln_name; *q && *p == *q; p++, q++);
+		if (*q)
+			continue;
+		/* a name ending in = takes an argument, otherwise it's the
+		   whole thing */
+		if (q[-1] == '=' || !*p)
+			break;
+	}
+	if (!l->ln_name)
+		p = spec;
+	if (!(*l->ln_open)(p)) {
+		link_rfd = -1;
+		link_wfd = -1;
+		return 0;
+	}
+	link_cur = l;
+	return 1;
+}
+
+int link_read(buf, len)
+SCH *buf;
+int len;
+{
+	if (!link_cur)
+		return -1;
+	return (*link_cur->ln_read)(buf, len);
+}
+
+int link_write(buf, len)
+SCH *buf;
+int len;
+{
+	if (!link_cur)
+		return -1;
+	return (*link_cur->ln_write)(buf, len);
+}
+
+int link_close()
+{
+	if (!link_cur)
+		return 0;
+	(*link_cur->ln_close)();
+	link_cur = 0;
+	link_rfd = -1;
+	link_wfd = -1;
+	return 1;
+}
@@ -0,0 +1,29 @@
+/* a link backend. the device in a link specification (see slip_config())
+   picks one by name; anything that isn't one of these is a serial port. */
+struct link {
+	char *ln_name;		/* name, or prefix if it ends in = */
+	int (*ln_open)();	/* (char *arg), sets link_rfd and link_wfd */
+	int (*ln_read)();	/* (SCH *buf, int len), like read() */
+	int (*ln_write)();	/* (SCH *buf, int len), like write() */
+	int (*ln_close)();
+	int ln_flags;
+};
+
+/* ln_flags */
+#define LINK_TTY	1	/* it's a tty, so line settings apply */
+#define LINK_SHARED	2	/* not ours, so leave it blocking */
+
+#if __GNUC__
+int link_open(char *spec);
+int link_read(SCH *buf, int len);
+int link_write(SCH *buf, int len);
+#else
+int link_open();
+int link_read();
+int link_write();
+#endif
+int link_close();
+
+extern int link_rfd;
+extern int link_wfd;
+extern struct link *link_cur;
@@ -5,37 +5,135 @@
  *
  * A simple TCP client that accepts a destination and a selection of strings
  * to send (which can be nothing, optionally separated or not by CR/LF), and
- * then returns the result. Suitable for HTTP/1.x, Gopher, Finger, Whois and
- * other such simplistic protocols.
+ * optionally standard input after them, and then returns the result.
+ * Suitable for HTTP/1.x, Gopher, Finger, Whois and other such simplistic
+ * protocols.
  */
 
 #include "compat.h"
 #include "slip.h"
 #include "dns.h"
 #include "tcp.h"
+#include "wheel.h"
+#include "sendq.h"
+#include "recvq.h"
+#include "tfo.h"
+#include "demux.h"
+#include "pbuf.h"
+#include "trace.h"
+
+/* if the other side says nothing for this long (in ms), give up */
+#ifndef IDLE_WAIT
+#define IDLE_WAIT 120000
+#endif
 
 SCH src[4] = { 0, 0, 0, 0};
 SCH dst[4] = { 0, 0, 0, 0};
 SCH seqno[4] = { 0, 0, 0, 0};
-SCH oldseqno[4] = { 0, 0, 0, 0};
 SCH ackno[4] = { 0, 0, 0, 0};
+/* the ACK we send while receiving, built once and then patched */
+SCH ack[TCP_CONTROL];
+int acksize = 0;
+/* how much we've taken in order and not yet acknowledged. we hold back the
+   ACK until there are two segments' worth, or TCP_DELACK ms go by, or we
+   have data to send it with (RFC 1122). */
+int owed = 0;
+struct timer delack;
+/* our connection's headers */
+struct tcb conn;
+/* what we send: each string straight out of argv and its CR/LF, without
+   copying them anywhere first, then standard input if -s was given */
+#ifndef OUT_FRAGS
+#define OUT_FRAGS 64
+#endif
+struct frag out[OUT_FRAGS];
+int outs = 0;
+SCH crlfs[] = "\r\n";
+struct sendq sq;
+#if !NO_TFO
+/* our fast open cookie for the server, if we have one (see tfo.c) */
+SCH cookie[TCP_COOKIE];
+int clen = 0;
+#endif
+/* what we receive: the data of each segment is put straight in here as
+   it's decoded (see slip_divert()), at its place in the stream, and what
+   is in order is written out in one go when the other side pushes or it
+   fills up. how much room is left is our window (see recvq.c); if it's
+   more than 65535 bytes, we ask to scale it. */
+#ifndef SINK_SIZE
+#define SINK_SIZE (4 * MSS_WINDOW)
+#endif
+SCH data[SINK_SIZE];
+struct sink sink;
+
+/* write out what we've received in order so far, which opens the window
+   back up */
+int drain()
+{
+	if (sink.sk_used)
+		fwrite(sink.sk_data, 1, sink.sk_used, stdout);
+	rq_shift(&sink);
+	tcp_window(&conn, rq_window(&sink));
+	return 1;
+}
+
+/* copy up to n bytes from the start of the strings to buf, for sending
+   with the SYN. returns how many. */
+int first(buf, n)
+SCH *buf;
+int n;
+{
+	int i, k, got;
+
+	got = 0;
+	for(i=0; i<outs && got<n; i++) {
+		k = out[i].fr_size;
+		if (k > n - got)
+			k = n - got;
+		slip_move(buf + got, out[i].fr_data, k);
+		got += k;
+	}
+	return got;
+}
+
+/* stage an ACK for what we have; it goes out with whatever else is sent
+   next. it's created the first time, and after that we just patch in the
+   new numbers and window. */
+int stage()
+{
+	if (!acksize)
+		acksize = tcp_build(&conn, ack, 16, seqno, ackno, 0);
+	else {
+		tcp_patch(ack, seqno, ackno, 0);
+		tcp_advert(&conn, ack);
+	}
+	owed = 0;
+	wheel_drop(&delack);
+	return slip_sack(ack, acksize);
+}
 
 MAIN
 main(argc, argv)
 int argc;
 char **argv;
 {
-	B16 checksum;
-	int j, port, size, rsize, offs, base;
-	SCH sport_h, sport_l, err, got, acked, crlf, dns;
-	SCH *packet, *reply, *string;
+	int j, port, size, rsize, offs, base, upfd, early, taken;
+	B32 lport;
+	SCH sport_h, sport_l, err, got, acked, crlf, dns, now;
+	SCH *packet, *reply;
+	SCH edge[4];
+	struct timer idle;
 
+	/* link settings, if any, come first */
+	if (!slip_args(&argc, &argv))
+		exit(1);
 	if (argc == 1) {
-		fprintf(stderr, "usage: %s [-in] so ur ce ip se rv er ip [servername] port [string] [string] ...\n", argv[0]);
+		fprintf(stderr, "usage: %s [-l link] [-ins] so ur ce ip se rv er ip [servername] port [string] [string] ...\n", argv[0]);
 		exit(1);
 	}
 	dns = 1;
 	crlf = 1;
+	upfd = -1;
 	base = 1;
 	acked = 0;
 	if (argv[1][0] == '-') {
@@ -49,6 +147,8 @@ char **argv;
 				dns = 0;
 			} else if (argv[1][j] == 'n') {
 				crlf = 0;
+			} else if (argv[1][j] == 's') {
+				upfd = 0;
 			} else {
 				fprintf(stderr, "unknown option -%c\n",
 					argv[1][j]);
@@ -57,11 +157,11 @@ char **argv;
 		}
 	}
 	if (dns && argc < (base + 10)) {
-		fprintf(stderr, "usage: %s so ur ce ip se rv er ip servername port [string] [string] ...\n", argv[0]);
+		fprintf(stderr, "usage: %s [-l link] so ur ce ip se rv er ip servername port [string] [string] ...\n", argv[0]);
 		exit(1);
 	}
 	if (!dns && argc < (base + 9)) {
-		fprintf(stderr, "usage: %s -n so ur ce ip se rv er ip port [string] [string] ...\n", argv[0]);
+		fprintf(stderr, "usage: %s [-l link] -n so ur ce ip se rv er ip port [string] [string] ...\n", argv[0]);
 		exit(1);
 	}
 
@@ -86,54 +186,43 @@ char **argv;
 	}
 
 	/* gather what we're transmitting */
-	string = malloc(MSS_WINDOW);
-	if (!string) {
-		perror("malloc");
-		exit(2);
-	}
-	if (base == argc) {
+	if (base == argc && upfd < 0) {
 		/* nothing to send */
 		acked = 1;
 	} else {
 		acked = 0;
 		/* any strings to send are now in argv[base] */
-		/* check length */
-		for(j=base;j<argc;j++) {
-			size += strlen(argv[j]) + crlf + crlf;
-		}
-		/* XXX: make this bigger for sends in the future */
-		if (size >= MSS_WINDOW) {
-			fprintf(stderr, "limited to %d characters\n",
-				MSS_WINDOW);
+		if ((argc - base) * (1 + crlf) > OUT_FRAGS) {
+			fprintf(stderr, "limited to %d strings\n",
+				OUT_FRAGS / (1 + crlf));
 			exit(1);
 		}
-		/* construct full string to transmit */
-		string[0] = 0;
+		outs = 0;
 		for(j=base;j<argc;j++) {
-			strcat(string, argv[j]);
-			if (crlf)
-				strcat(string, "\r\n");
+			out[outs].fr_data = (SCH *)argv[j];
+			out[outs++].fr_size = strlen(argv[j]);
+			if (crlf) {
+				out[outs].fr_data = crlfs;
+				out[outs++].fr_size = 2;
+			}
 		}
 	}
 
-	reply = malloc(PACKET_SIZE);
+	reply = pb_get();
 	if (!reply) {
-		perror("malloc");
-		free(string);
+		fprintf(stderr, "out of packet buffers\n");
 		exit(2);
 	}
-	packet = malloc(PACKET_SIZE);
+	packet = pb_get();
 	if (!packet) {
-		perror("malloc");
-		free(reply);
-		free(string);
+		fprintf(stderr, "out of packet buffers\n");
+		pb_free(reply);
 		exit(2);
 	}
 	if (!slip_setup()) {
 		perror("SLIP failure");
-		free(packet);
-		free(reply);
-		free(string);
+		pb_free(packet);
+		pb_free(reply);
 		exit(3);
 	}
 
@@ -147,9 +236,8 @@ char **argv;
 		}
 		if (!got) {
 			fprintf(stderr, "couldn't resolve %s\n", argv[dns]);
-			free(packet);
-			free(reply);
-			free(string);
+			pb_free(packet);
+			pb_free(reply);
 			slip_stop();
 			exit(5);
 		}
@@ -165,6 +253,10 @@ char **argv;
 	/* create random source port # */
 	sport_h = rand() & 0xff;
 	sport_l = rand() & 0xff;
+	/* hold on to anything for it, from now on */
+	lport = sport_h & 0xff;
+	lport = (lport << 8) | (sport_l & 0xff);
+	dmx_want(DMX_TCP, lport);
 	/* create random sequence number */
 	seqno[0] = rand() & 0xff;
 	seqno[1] = rand() & 0xff;
@@ -175,312 +267,361 @@ char **argv;
 	ackno[1] = 0;
 	ackno[2] = 0;
 	ackno[3] = 0;
-	/* create SYN */
-	size = tcp_template(packet, src, dst, port, sport_h, sport_l,
-		2, seqno, ackno);
+	/* set up the headers and our window, and create SYN */
+	tcp_prime(&conn, src, dst, port, sport_h, sport_l);
+	rq_start(&sink, data, SINK_SIZE, dst, (B32)port, lport, ackno);
+	tcp_window(&conn, rq_window(&sink));
+	early = 0;
+#if !NO_TFO
+	/* fast open (RFC 7413): if we have a cookie for them, as much of our
+	   strings as fits in a segment goes with the SYN. if not, ask for
+	   one for next time. */
+	clen = tfo_load(dst, cookie);
+	tcp_cookie(&conn, cookie, clen);
+	if (clen && !acked)
+		early = first(packet + tcp_hlen(&conn, 2), MSS_WINDOW);
+#endif
+	size = tcp_build(&conn, packet, 2, seqno, ackno, early);
 	/* wait for SYN+ACK, bump seqno, get ackno */
-	got = tcp_twiddle(packet, size, (2 | 16), seqno, ackno, 1, &err);
+	got = tcp_twiddle(packet, size, (2 | 16), seqno, ackno, 1,
+		(B32)TCP_RTO, &err);
 	if (!got) {
+#if !NO_TFO
+		/* something between us may not like SYNs with data; go
+		   without next time */
+		if (err == TCP_TIMEOUT && clen)
+			tfo_save(dst, cookie, 0);
+#endif
 		if (err == TCP_NOMEM) {
 			fprintf(stderr, "out of memory\n");
 		} else if (err == TCP_SLIP_ERROR) {
 			fprintf(stderr, "transmission failed\n");
+		} else if (err == TCP_TIMEOUT) {
+			fprintf(stderr, "connection timed out\n");
 		} else {
 			fprintf(stderr, "unexpected error %d\n", err);
 		}
-		free(packet);
-		free(reply);
-		free(string);
+		pb_free(packet);
+		pb_free(reply);
 		slip_stop();
 		exit(3);
 	}
 	if (got & 4) { /* RST => connection refused */
 		fprintf(stderr, "connection refused\n");
-		free(packet);
-		free(reply);
-		free(string);
+		pb_free(packet);
+		pb_free(reply);
 		slip_stop();
 		exit(4);
 	}
-#if DEBUG
-fprintf(stderr, "seqno: us %02x%02x%02x%02x \n",
-	(unsigned int)seqno[0] & 0xff,
-	(unsigned int)seqno[1] & 0xff,
-	(unsigned int)seqno[2] & 0xff,
-	(unsigned int)seqno[3] & 0xff);
-#endif
+	TRACE(TR_SEQNO, 0, trace_word(seqno));
+	/* see if they'll scale windows, and start timing from how long
+	   that took */
+	tcp_agree(&conn);
+	if (tcp_took >= 0)
+		tcp_measure(&conn, tcp_took);
 	/* bump ackno */
 	tcp_total32(ackno, 1);
-	/* use helper method to create ACK packet */
-	size = tcp_template(packet, src, dst, port, sport_h, sport_l,
-		16, seqno, ackno);
-	if (!slip_ship(packet, size)) {
-		perror("SLIP transmission failed");
-		free(packet);
-		free(reply);
-		free(string);
-		slip_stop();
-		exit(3);
+	/* if they took what we sent with the SYN, they've acknowledged it
+	   along with the SYN; if not, it has to go again */
+	taken = 0;
+	if (early) {
+		for(j=0; j<4; j++)
+			edge[j] = seqno[j];
+		tcp_total32(edge, early);
+		for(j=0; j<4 && edge[j] == tcp_syn.sy_ackno[j]; j++)
+			;
+		if (j == 4)
+			taken = early;
 	}
+#if !NO_TFO
+	/* keep any new cookie they gave us for next time */
+	if (tcp_syn.sy_clen > 0) {
+		j = 0;
+		if (tcp_syn.sy_clen == clen) {
+			for(; j<clen && tcp_syn.sy_cookie[j] == cookie[j]; j++)
+				;
+		}
+		if (j != tcp_syn.sy_clen)
+			tfo_save(dst, tcp_syn.sy_cookie, tcp_syn.sy_clen);
+	}
+#endif
 
-	/***** send and receive phase *****/
-
-	/* create packet to transmit, if one was specified */
-	/* currently this must fit into our payload */
+	/* queue up what we're sending, if anything; it goes out as the
+	   window allows (see sendq.c) */
 	if (!acked) {
-		oldseqno[0] = seqno[0];
-		oldseqno[1] = seqno[1];
-		oldseqno[2] = seqno[2];
-		oldseqno[3] = seqno[3];
-		size = tcp_transmittal(packet, src, dst, port,
-			sport_h, sport_l,
-			seqno, ackno, string);
-		if (!size) {
-			fprintf(stderr, "out of memory\n");
-			free(packet);
-			free(reply);
-			free(string);
+		sq_start(&sq, &conn, seqno, ackno, out, outs, upfd);
+		sq_skip(&sq, (B32)taken);
+		sq_seq(&sq, sq.sq_nxt, seqno);
+		/* an upload is over when we say so, which some servers wait
+		   for before they answer */
+		if (upfd >= 0)
+			sq_close(&sq);
+	}
+
+	/* finish the handshake. if we have strings still to send, the first
+	   segment of them does that, which saves a bare ACK; otherwise, use
+	   helper method to create ACK packet */
+	if (acked || sq.sq_flen == taken) {
+		size = tcp_build(&conn, packet, 16, seqno, ackno, 0);
+		if (!slip_ship(packet, size)) {
+			perror("SLIP transmission failed");
+			pb_free(packet);
+			pb_free(reply);
 			slip_stop();
-			exit(2);
+			exit(3);
 		}
-		/* pre-compute expected value */
-		tcp_total32(seqno, strlen(string));
-	} /* otherwise pretend we sent "something" */
+	}
 
+	/***** send and receive phase *****/
+
+	wheel_arm(&idle, (B32)IDLE_WAIT, 0, 0);
+	slip_divert(&sink);
 	for(;;) {
-		/* if not already acked, send packet */
+		/* if not all acked, send whatever their window has room for,
+		   and anything the retransmission timer says to send again */
+		j = 1;
 		if (!acked) {
-			j = slip_ship(packet, size);
-			if (!j) {
-				perror("SLIP transmission failure");
-				free(packet);
-				free(reply);
-				free(string);
-				slip_stop();
-				exit(3);
+			sq.sq_sent = 0;
+			if (!sq_send(&sq)) {
+				/* if they've stopped listening, we're done */
+				if (sq.sq_err == TCP_TIMEOUT)
+					wheel_drop(&idle);
+				else if (sq.sq_err == TCP_READ_ERROR) {
+					perror("can't read standard input");
+					pb_free(packet);
+					pb_free(reply);
+					slip_stop();
+					exit(3);
+				} else
+					j = 0;
+			}
+			/* our ACKs say how far we've got */
+			sq_seq(&sq, sq.sq_nxt, seqno);
+			/* (there may have been nothing to send after all) */
+			if (sq_done(&sq))
+				acked = 1;
+			/* whatever went carried our ACK */
+			if (sq.sq_sent) {
+				owed = 0;
+				wheel_drop(&delack);
 			}
 		}
-		rsize = slip_slurp(reply, PACKET_SIZE);
+		/* an ACK we've held back long enough goes now */
+		if (j && owed && !delack.tw_live)
+			j = stage();
+		/* along with any ACK we staged on the last go-round */
+		if (!j || !slip_sweep()) {
+			perror("SLIP transmission failure");
+			pb_free(packet);
+			pb_free(reply);
+			slip_stop();
+			exit(3);
+		}
+		if (!idle.tw_live) {
+			fprintf(stderr, "connection timed out\n");
+			pb_free(packet);
+			pb_free(reply);
+			slip_stop();
+			exit(3);
+		}
+		rsize = dmx_recv(reply, PACKET_SIZE, DMX_TCP, lport);
 		if (!rsize) {
+			if (slip_fault == SLIP_TIMEOUT)
+				continue;
 			perror("SLIP receive failure");
-			free(packet);
-			free(reply);
-			free(string);
+			pb_free(packet);
+			pb_free(reply);
 			slip_stop();
 			exit(3);
 		}
 
-		/* verify its checksum by reconstructing the pseudo-header */
-		j = reply[9]; /* hold temporarily */
-		/* source IP */
-		reply[8] = reply[12];
-		reply[9] = reply[13];
-		reply[10] = reply[14];
-		reply[11] = reply[15];
-
-		/* destination IP */
-		reply[12] = reply[16];
-		reply[13] = reply[17];
-		reply[14] = reply[18];
-		reply[15] = reply[19];
-
-		/* zero, TCP, packet length */
-		reply[16] = 0;
-		reply[17] = 6;
-		reply[18] = ((rsize - 20) >> 8) & 0xff;
-		reply[19] = ((rsize - 20) & 0x00ff);
-		/* pad null in checksum if not even 16-bit boundary */
-		if (rsize & 1) {
-			reply[rsize] = 0;
-			checksum = slip_sum(reply + 8, rsize - 7);
-		} else {
-			checksum = slip_sum(reply + 8, rsize - 8);
-		}
-		if (checksum) { /* RFC 1071 */
+		/* it's TCP to our port, or we wouldn't have it */
+		/* verify its checksum */
+		if (!slip_valid(reply, rsize)) {
+			TRACE(TR_CSUM, 6, rsize);
 			continue;
 		}
-
-		/* reject non-TCP */
-		if (j != 6) continue;
-		/* reject anything not to our port */
-		if (reply[22] != sport_h || reply[23] != sport_l)
-			continue;
+		/* they're still there */
+		wheel_arm(&idle, (B32)IDLE_WAIT, 0, 0);
 
 		/* check flags */
 		if (reply[33] & 4) /* RST */
 			break;
 
-		if ((reply[33] & 16) || (reply[33] & 1)) { /* ACK or FIN */
-			/* they sent data first if ackno == old seqno */
-			if (
-				reply[28] == oldseqno[0] &&
-				reply[29] == oldseqno[1] &&
-				reply[30] == oldseqno[2] &&
-				reply[31] == oldseqno[3]
-			) {
-				/* fall through */
-			} else {
-				if (!acked) {
-					/* make sure ackno == our seqno */
-					if (
-						reply[28] == seqno[0] &&
-						reply[29] == seqno[1] &&
-						reply[30] == seqno[2] &&
-						reply[31] == seqno[3]
-					) acked = 1;
-				}
+		/* move what we're sending along, and stop when it's all
+		   been acknowledged */
+		if (!acked && (reply[33] & 16)) {
+			sq_ack(&sq, reply);
+			if (sq_done(&sq)) {
+				acked = 1;
+				wheel_drop(&sq.sq_timer);
 			}
 		}
-#if DEBUG
-fprintf(stderr, "seqno: them %02x%02x%02x%02x | us %02x%02x%02x%02x \n",
-	(unsigned int)reply[28] & 0xff,
-	(unsigned int)reply[29] & 0xff,
-	(unsigned int)reply[30] & 0xff,
-	(unsigned int)reply[31] & 0xff,
-	(unsigned int)seqno[0] & 0xff,
-	(unsigned int)seqno[1] & 0xff,
-	(unsigned int)seqno[2] & 0xff,
-	(unsigned int)seqno[3] & 0xff);
-#endif
+		TRACE(TR_SEQNO, trace_word(reply + 28), trace_word(seqno));
 
 		/***** receive data *****/
-		offs = reply[32] >> 2;
+		offs = (reply[32] >> 2) & 0x3c;
 		offs += 20; /* skip IP header */
-		if (offs >= rsize) {
-			/* no data */
-			/* breakout if FIN or SYN */
-			if (reply[33] & 1) break;
-			if (reply[33] & 2) break;
-			/* else wait for more */
-			continue;
+		j = 0;
+		now = 0;
+		if (offs < rsize) {
+			/* take the data received. it's good, so if it went
+			   to the sink, it stays there; otherwise (such as if
+			   the headers were compressed) it's in the reply. if
+			   it's next, it and anything held after it are in
+			   order now, and ackno has moved along to say so. */
+			j = rq_take(&sink, reply, rsize);
+			if (j)
+				TRACE(TR_ACKNO, trace_word(reply + 24),
+					trace_word(ackno));
+			/* print it when they push, or we're out of room */
+			/* (and if we ran out, tell them it's open again) */
+			now = (rq_window(&sink) < MSS_WINDOW);
+			if ((j && (reply[33] & 8)) || now)
+				drain();
+			tcp_window(&conn, rq_window(&sink));
 		}
 
-		/* check that the sequence number is what we're expecting */
-		if (
-			reply[24] == ackno[0] &&
-			reply[25] == ackno[1] &&
-			reply[26] == ackno[2] &&
-			reply[27] == ackno[3]
-		) {
-#if DEBUG
-fprintf(stderr, "ackno: them %02x%02x%02x%02x | us %02x%02x%02x%02x \n",
-	(unsigned int)reply[24] & 0xff,
-	(unsigned int)reply[25] & 0xff,
-	(unsigned int)reply[26] & 0xff,
-	(unsigned int)reply[27] & 0xff,
-	(unsigned int)ackno[0] & 0xff,
-	(unsigned int)ackno[1] & 0xff,
-	(unsigned int)ackno[2] & 0xff,
-	(unsigned int)ackno[3] & 0xff);
-#endif
-			/* print data received */
-			/* (note that technically we should wait for a PSH) */
-			for(j=offs;j<rsize;j++) {
-				fprintf(stdout, "%c", reply[j]);
+		/* breakout if SYN, or FIN once we have everything before
+		   it; else, with no data, wait for more */
+		if (reply[33] & 2) break;
+		if (rq_fin(&sink, reply, rsize)) break;
+		if (offs >= rsize && !(reply[33] & 1)) continue;
+
+		/* new data in order, with nothing held after it, can wait
+		   for more, up to a point. anything else (data we already
+		   have, or that came early, or fills a gap, or an early FIN)
+		   means something went missing, so tell them right away. */
+		if (j && !sink.sk_runs && !now) {
+			owed += j;
+			if (owed < 2 * MSS_WINDOW) {
+				if (!delack.tw_live)
+					wheel_arm(&delack, (B32)TCP_DELACK,
+						0, 0);
+				continue;
 			}
-			/* rev ackno by the length to indicate acceptance */
-			tcp_total32(ackno, rsize - offs);
-#if DEBUG
-fprintf(stderr, "ackno: them %02x%02x%02x%02x | us %02x%02x%02x%02x \n",
-	(unsigned int)reply[24] & 0xff,
-	(unsigned int)reply[25] & 0xff,
-	(unsigned int)reply[26] & 0xff,
-	(unsigned int)reply[27] & 0xff,
-	(unsigned int)ackno[0] & 0xff,
-	(unsigned int)ackno[1] & 0xff,
-	(unsigned int)ackno[2] & 0xff,
-	(unsigned int)ackno[3] & 0xff);
-#endif
 		}
-
-		/* if FIN, break out here */
-		if (reply[33] & 1) break;
-
-		/* create an ACK */
-		size = tcp_template(packet, src, dst, port, sport_h, sport_l,
-			16, seqno, ackno);
-		/* send it */
-		if (!slip_ship(packet, size)) {
+		/* stage it; it goes out with our data, if we're resending */
+		if (!stage()) {
 			perror("SLIP transmission error");
-			free(packet);
-			free(reply);
-			free(string);
+			pb_free(packet);
+			pb_free(reply);
 			exit(3);
 		}
-		/* our packet needs to be regenerated with new ackno */
-		if (!acked) {
-			size = tcp_transmittal(packet, src, dst, port,
-				sport_h, sport_l,
-				seqno, ackno, string);
-		}
-		/* loop and resend */
+		/* loop and send more */
 	}
+	wheel_drop(&sq.sq_timer);
+	wheel_drop(&sq.sq_poll);
+	wheel_drop(&delack);
+	wheel_drop(&idle);
+	slip_divert((struct sink *)0);
+	drain();
 
 	/***** connection is terminating *****/
 	if (reply[33] & 4) { /* terminated on RST, don't send anything else */
 		fprintf(stderr, "connection reset\n");
-		free(packet);
-		free(reply);
-		free(string);
+		pb_free(packet);
+		pb_free(reply);
 		exit(3);
 	}
 	if (reply[33] & 2) { /* terminated on SYN?!, send a RST */
-		size = tcp_template(packet, src, dst, port, sport_h, sport_l,
-			4, seqno, ackno);
+		size = tcp_build(&conn, packet, 4, seqno, ackno, 0);
 		/* send it, but just suppress the error if it fails */
 		slip_ship(packet, size);
-		free(packet);
-		free(reply);
-		free(string);
+		pb_free(packet);
+		pb_free(reply);
 		/* call it a normal termination, I guess */
 		exit(0);
 	}
 
-#if DEBUG
-fprintf(stderr, "seqno! them %02x%02x%02x%02x | us %02x%02x%02x%02x \n",
-	(unsigned int)reply[28] & 0xff,
-	(unsigned int)reply[29] & 0xff,
-	(unsigned int)reply[30] & 0xff,
-	(unsigned int)reply[31] & 0xff,
-	(unsigned int)seqno[0] & 0xff,
-	(unsigned int)seqno[1] & 0xff,
-	(unsigned int)seqno[2] & 0xff,
-	(unsigned int)seqno[3] & 0xff);
-fprintf(stderr, "ackno! them %02x%02x%02x%02x | us %02x%02x%02x%02x \n",
-	(unsigned int)reply[24] & 0xff,
-	(unsigned int)reply[25] & 0xff,
-	(unsigned int)reply[26] & 0xff,
-	(unsigned int)reply[27] & 0xff,
-	(unsigned int)ackno[0] & 0xff,
-	(unsigned int)ackno[1] & 0xff,
-	(unsigned int)ackno[2] & 0xff,
-	(unsigned int)ackno[3] & 0xff);
-#endif
+	/* they've closed their side, but they may not have everything we
+	   sent yet. keep sending, going back for anything lost, until they
+	   do; only then is it time to close ours. */
+	if (!acked) {
+		wheel_arm(&idle, (B32)IDLE_WAIT, 0, 0);
+		while (!sq_done(&sq) && idle.tw_live) {
+			if (!sq_send(&sq) || !slip_sweep())
+				break;
+			sq_seq(&sq, sq.sq_nxt, seqno);
+			rsize = dmx_recv(reply, PACKET_SIZE, DMX_TCP, lport);
+			if (!rsize) {
+				if (slip_fault == SLIP_TIMEOUT)
+					continue;
+				break;
+			}
+			if (!slip_valid(reply, rsize))
+				continue;
+			wheel_arm(&idle, (B32)IDLE_WAIT, 0, 0);
+			if (reply[33] & 4)
+				break;
+			if (reply[33] & 16)
+				sq_ack(&sq, reply);
+		}
+		wheel_drop(&sq.sq_timer);
+		wheel_drop(&sq.sq_poll);
+		wheel_drop(&idle);
+		if (!sq_done(&sq)) {
+			fprintf(stderr, "connection closed before all we "
+				"sent was acknowledged: upload truncated\n");
+			pb_free(packet);
+			pb_free(reply);
+			slip_stop();
+			exit(3);
+		}
+		sq_seq(&sq, sq.sq_nxt, seqno);
+	}
+
+	TRACE(TR_SEQNO, trace_word(reply + 28), trace_word(seqno));
+	TRACE(TR_ACKNO, trace_word(reply + 24), trace_word(ackno));
 
 	/***** TCP teardown *****/
-	/* send final FIN+ACK */
-	size = tcp_template(packet, src, dst, port, sport_h, sport_l,
-		(1 | 16), seqno, ackno);
-	/* wait for ACK, bump seqno, get ackno */
-	got = tcp_twiddle(packet, size, (1 | 16), seqno, ackno, 1, &err);
-	/* ignore any errors, we're terminating anyway */
-	if (got) {
-		/* send my FIN */
-		size = tcp_template(packet, src, dst, port, sport_h, sport_l,
-			1, seqno, ackno);
-		/* wait for FIN-ACK, don't! bump seqno, get ackno */
-		got = tcp_twiddle(packet, size, (1 | 16), seqno, ackno, 0, &err);
-		if (got) {
-			/* bump ackno, send my ACK */
-			tcp_total32(ackno, 1);
-			size = tcp_template(packet, src, dst, port, sport_h,
-				sport_l, 16, seqno, ackno);
+	if (sq_shut(&sq)) {
+		/* we sent our FIN after the upload, so just acknowledge
+		   theirs. if they haven't acknowledged ours, send it again
+		   with that until they do, and acknowledge theirs again if
+		   it comes again. */
+		tcp_total32(ackno, 1);
+		sq_seq(&sq, sq.sq_end, seqno);
+		if (sq_done(&sq)) {
+			tcp_total32(seqno, 1);
+			/* (their FIN, which we haven't acknowledged yet) */
+			got = 1;
+		} else {
+			for(j=0; j<4; j++)
+				edge[j] = ackno[j];
+			size = tcp_build(&conn, packet, (1 | 16), seqno,
+				ackno, 0);
+			got = tcp_twiddle(packet, size, 16, seqno, edge, 1,
+				conn.tc_rto, &err);
+		}
+		if (got & 1) {
+			size = tcp_build(&conn, packet, 16, seqno, ackno, 0);
 			got = slip_ship(packet, size);
 		}
+	} else {
+		/* send final FIN+ACK */
+		size = tcp_build(&conn, packet, (1 | 16), seqno, ackno, 0);
+		/* wait for ACK, bump seqno, get ackno */
+		got = tcp_twiddle(packet, size, (1 | 16), seqno, ackno, 1,
+			conn.tc_rto, &err);
+		/* ignore any errors, we're terminating anyway */
+		if (got) {
+			/* send my FIN */
+			size = tcp_build(&conn, packet, 1, seqno, ackno, 0);
+			/* wait for FIN-ACK, don't! bump seqno, get ackno */
+			got = tcp_twiddle(packet, size, (1 | 16), seqno,
+				ackno, 0, conn.tc_rto, &err);
+			if (got) {
+				/* bump ackno, send my ACK */
+				tcp_total32(ackno, 1);
+				size = tcp_build(&conn, packet, 16, seqno,
+					ackno, 0);
+				got = slip_ship(packet, size);
+			}
+		}
 	}
-	free(packet);
-	free(reply);
-	free(string);
+	pb_free(packet);
+	pb_free(reply);
 	slip_stop();
 	exit((got) ? 0 : 3);
 }
@@ -23,8 +23,11 @@ char **argv;
 {
 	int i, j;
 
+	/* link settings, if any, come first */
+	if (!slip_args(&argc, &argv))
+		exit(1);
 	if (argc != 10) {
-		fprintf(stderr, "usage: %s so ur ce ip re so lv er name\n",
+		fprintf(stderr, "usage: %s [-l link] so ur ce ip re so lv er name\n",
 			argv[0]);
 		exit(1);
 	}
@@ -70,9 +73,10 @@ char **argv;
 			slip_stop();
 			exit(4);
 		}
-		/* try again if no answers or a corrupt answer */
+		/* try again if no answers, a corrupt answer or none at all */
 		if (answer[0] != DNS_NO_ANSWERS &&
-			answer[0] != DNS_BAD_ANSWER) {
+			answer[0] != DNS_BAD_ANSWER &&
+			answer[0] != DNS_TIMEOUT) {
 			fprintf(stdout, "unexpected error code %d\n",
 				answer[0]);
 			slip_stop();
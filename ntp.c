@@ -13,9 +13,28 @@
 #include "compat.h"
 #include "dns.h"
 #include "slip.h"
+#include "udp.h"
+#include "wheel.h"
+#include "demux.h"
+#include "pbuf.h"
 
 /* NTP is up to 544 bytes + 20 IP + 8 UDP + fudgy fudge factor */
+#if PB_SIZE < 640
+#define PACKET_SIZE PB_SIZE
+#else
 #define PACKET_SIZE 640
+#endif
+/* but our query is only a header */
+#define QUERY_SIZE (20+8+48)
+
+/* how long to wait for the server each time we ask, in ms, and how many
+   times we ask */
+#ifndef NTP_WAIT
+#define NTP_WAIT 5000
+#endif
+#ifndef NTP_TRIES
+#define NTP_TRIES 3
+#endif
 
 SCH src[4] = {0, 0, 0, 0};
 SCH dst[4] = {0, 0, 0, 0};
@@ -26,17 +45,21 @@ main(argc, argv)
 int argc;
 char **argv;
 {
-	/* RFC 6864 indicates that pretty much nothing relies on the
-         * uniqueness of the IPv4 ID field anymore. */
-	B16 checksum;
 	B32 ntime;
 	B32 epoch = 2208988800;
-	int j, size, base;
+	int j, size, base, tries;
+	B32 port;
 	SCH *packet;
+	SCH query[QUERY_SIZE];
+	struct timer t;
+	struct udb ud;
 	SCH dns, sport_h, sport_l;
 
+	/* link settings, if any, come first */
+	if (!slip_args(&argc, &argv))
+		exit(1);
 	if (argc == 1) {
-		fprintf(stderr, "usage: %s [-i] so ur ce ip se rv er ip [hostname]\n", argv[0]);
+		fprintf(stderr, "usage: %s [-l link] [-i] so ur ce ip se rv er ip [hostname]\n", argv[0]);
 		exit(1);
 	}
 	dns = 1;
@@ -51,7 +74,7 @@ char **argv;
 		}
 	}	 
 	if (argc < (base + 8 + dns)) {
-		fprintf(stderr, "usage: %s [-i] so ur ce ip se rv er ip [hostname]\n", argv[0]);
+		fprintf(stderr, "usage: %s [-l link] [-i] so ur ce ip se rv er ip [hostname]\n", argv[0]);
 		exit(1);
 	}
 
@@ -65,16 +88,16 @@ char **argv;
 	dst[2] = atoi(argv[base++]);
 	dst[3] = atoi(argv[base++]);
 
-	/* we clear the packet manually anyway, so don't bother with calloc */
-	packet = malloc(PACKET_SIZE);
+	/* pool buffers aren't cleared, but we clear the packet manually anyway */
+	packet = pb_get();
 	if (!packet) {
-		perror("malloc");
+		fprintf(stderr, "out of packet buffers\n");
 		exit(2);
 	}
 	slip_splat(packet, PACKET_SIZE);
 	if (!slip_setup()) {
 		perror("SLIP failure");
-		free(packet);
+		pb_free(packet);
 		exit(4);
 	}
 
@@ -85,7 +108,7 @@ char **argv;
 		}
 		if (!size) {
 			fprintf(stderr, "could not resolve hostname\n");
-			free(packet);
+			pb_free(packet);
 			slip_stop();
 			exit(3);
 		}
@@ -95,176 +118,79 @@ char **argv;
 		dst[3] = answer[3];
 	}
 
-	/***** IP header *****/
-	/* version and length of IP header */
-	packet[0] = 0x45;	/* IPv4, 5 32-bit ints == 20 bytes */
-
-	/* TOS as DSCP and ECN: just use zero */
-	packet[1] = 0x00;
-
-	/* length of complete packet and payload, big endian */
-	size = 20 + /* IP header */
-		8 + /* UDP header */
-		48; /* size of NTP request */
-	packet[2] = (size >> 8) & 0xff;
-	packet[3] = (size & 0x00ff);
-
-	/* identification, big endian (see above) */
-	packet[4] = rand() & 0xff;
-	packet[5] = rand() & 0xff;
-
-	/* fragmentation: none, not allowed */
-	packet[6] = 0;
-	packet[7] = 0;
-
-	/* come back to the rest at the end */
-
-	/***** UDP pseudo-header *****/
-	/* we put this here so we can compute the checksum early, and then
-           fill in our IP information and checksum that at the end. */
-
-	/* source IP */
-	packet[8] = src[0];
-	packet[9] = src[1];
-	packet[10] = src[2];
-	packet[11] = src[3];
-
-	/* destination IP */
-	packet[12] = dst[0];
-	packet[13] = dst[1];
-	packet[14] = dst[2];
-	packet[15] = dst[3];
-
-	/* explicit zero */
-	packet[16] = 0;
-	/* protocol, always 17 for UDP */
-	packet[17] = 17;
-	/* length,  minus IP header */
-	packet[18] = ((size - 20) >> 8) & 0xff;
-	packet[19] = ((size - 20) & 0x00ff);
-
-	/***** UDP payload *****/
-	/* source port. don't care, but check it matches */
-	sport_h = rand() & 0xff;
-	packet[20] = sport_h;
-	sport_l = rand() & 0xff;
-	packet[21] = sport_l;
-
-	/* destination port, big endian */
-	packet[22] = 0;
-	packet[23] = 123;
-
-	/* length again, minus IP header */
-	packet[24] = ((size - 20) >> 8) & 0xff;
-	packet[25] = ((size - 20) & 0x00ff);
-
-	/* we'll come back to the checksum at the end */
-
 	/***** NTP payload *****/
 	packet[28] = 0x1b; /* version number (v3) + client query */
 	/* remainder is zero and is already clear */
 
-	/* compute UDP checksum (with checksum field = 0) */
-	/* including pseudo header */
-	checksum = slip_sum(packet + 8, size - 8);
-	packet[26] = (checksum >> 8) & 0xff;
-	packet[27] = (checksum & 0x00ff); 
-
-	/***** finish IP packet ****/
-	/* TTL of 64 */
-	packet[8] = 64;
-	
-	/* protocol is UDP */
-	packet[9] = 17;
-
-	/* zero out checksum */
-	packet[10] = 0;
-	packet[11] = 0;
-
-	/* source IP */
-	packet[12] = src[0];
-	packet[13] = src[1];
-	packet[14] = src[2];
-	packet[15] = src[3];
-
-	/* destination IP */
-	packet[16] = dst[0];
-	packet[17] = dst[1];
-	packet[18] = dst[2];
-	packet[19] = dst[3];
-
-	/* compute IP checksum (with checksum field = 0) */
-	checksum = slip_sum(packet, 20);
-	packet[10] = (checksum >> 8) & 0xff;
-	packet[11] = (checksum & 0x00ff); 
-	if(!slip_ship(packet, size)) {
-		perror("SLIP failure");
-		free(packet);
-		exit(4);
-	}
+	/* source port. don't care, but check it matches */
+	sport_h = rand() & 0xff;
+	sport_l = rand() & 0xff;
 
+	/* the IP and UDP headers go in front */
+	udp_prime(&ud, src, dst, 123, sport_h, sport_l);
+	size = udp_build(&ud, packet, 48);
+	port = sport_h & 0xff;
+	port = (port << 8) | (sport_l & 0xff);
+	dmx_want(DMX_UDP, port);
+	/* keep a copy; the reply lands on top of it and we may have to
+	   ask again */
+	for(j=0; j<QUERY_SIZE; j++)
+		query[j] = packet[j];
+
+	t.tw_live = 0;
+	tries = 0;
 	for(;;) {
-		size = slip_slurp(packet, PACKET_SIZE);
-		if (!size) { /* something is wrong */
+		if (!t.tw_live) {
+			if (tries++ == NTP_TRIES) {
+				fprintf(stderr, "no response from server\n");
+				slip_stop();
+				pb_free(packet);
+				exit(6);
+			}
+			if(!slip_ship(query, QUERY_SIZE)) {
+				perror("SLIP failure");
+				pb_free(packet);
+				exit(4);
+			}
+			wheel_arm(&t, (B32)NTP_WAIT, 0, 0);
+		}
+
+		size = dmx_recv(packet, PACKET_SIZE, DMX_UDP, port);
+		if (!size) {
+			if (slip_fault == SLIP_TIMEOUT)
+				continue;
+			/* something is wrong */
 			perror("SLIP failure");
-			free(packet);
+			pb_free(packet);
 			exit(4);
 		}
 
-		j = packet[9]; /* hold for a moment */
-
-		/* verify its checksum by reconstructing the pseudo-header */
-		/* source IP */
-		packet[8] = packet[12];
-		packet[9] = packet[13];
-		packet[10] = packet[14];
-		packet[11] = packet[15];
-
-		/* destination IP */
-		packet[12] = packet[16];
-		packet[13] = packet[17];
-		packet[14] = packet[18];
-		packet[15] = packet[19];
-
-		/* zero, UDP, packet length */
-		packet[16] = 0;
-		packet[17] = 17;
-		packet[18] = packet[24];
-		packet[19] = packet[25];
-
+		/* it's UDP to our port, or we wouldn't have it */
 		/* packet is always even sized */
 		if (size & 1) {
 			fprintf(stderr, "corrupt response from server\n");
-			free(packet);
+			pb_free(packet);
 			exit(5);
 			/* we don't wait again, the packet was mangled but
 				because it's UDP it will not be re-sent. */
 		}
-		checksum = slip_sum(packet + 8, size - 8);
-		if (checksum) { /* RFC 1071 */
+		if (!slip_valid(packet, size)) {
 			fprintf(stderr, "corrupt response from server\n");
-			free(packet);
+			pb_free(packet);
 			exit(5);
 			/* again, no way to recover */
 		}
 		if (size < (20+8+48)) {
 			fprintf(stderr, "truncated response from server\n");
-			free(packet);
+			pb_free(packet);
 			exit(5);
 			/* again, no way to recover */
 		}
 
-		/* fast kickouts */
-		/* reject non-UDP */
-		if (j != 17)
-			continue;
-		/* reject replies that aren't to our pseudoport */
-		if (packet[22] != sport_h || packet[23] != sport_l)
-			continue;
-
 		/* we have a packet that purports to be our reply */
 		break;
 	}
+	wheel_drop(&t);
 
 	/***** process the reply *****/
 	fprintf(stdout, "stratum %d refid ", packet[29]);
@@ -315,6 +241,6 @@ char **argv;
 	fprintf(stdout, "%s\n", ctime(&ntime));
 #endif
 	slip_stop();
-	free(packet);
+	pb_free(packet);
 	exit(0);
 }
@@ -0,0 +1,86 @@
+/* Packet buffer pool for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * Everything used to malloc() a buffer for each datagram it sent or
+ * waited for and free() it afterwards, tcp_twiddle() on every call. Over
+ * a long session that fragments the little heap we have on small systems,
+ * and the time it takes shows up on every segment. Instead there is a
+ * fixed pool of full-sized buffers, set aside when the program loads, and
+ * nothing in the stack touches the heap after that.
+ *
+ * pb_get() takes a buffer from the pool, or returns NULL if they are all
+ * in use. pb_hold() adds a reference to one, for when more than one thing
+ * needs it to stay around, and pb_free() drops one; the buffer goes back
+ * to the pool when the last is gone. Buffers are PB_SIZE bytes, plus one
+ * for padding, and pb_left says how many are free.
+ */
+
+#include "compat.h"
+#include "pbuf.h"
+
+struct pbuf {
+	SCH pb_data[PB_SIZE + 1];	/* must be first, see pb_find() */
+	int pb_refs;
+};
+
+struct pbuf pb_pool[PB_COUNT];
+int pb_spare[PB_COUNT];	/* free buffers, as a stack of indexes */
+int pb_left = 0;
+int pb_ready = 0;
+
+/* find the buffer a pointer from pb_get() belongs to, or -1 if it isn't
+   one of ours */
+int pb_find(p)
+SCH *p;
+{
+	struct pbuf *b;
+
+	b = (struct pbuf *)p;
+	if (b < pb_pool || b >= pb_pool + PB_COUNT || b->pb_data != p)
+		return -1;
+	return b - pb_pool;
+}
+
+SCH *pb_get()
+{
+	int i;
+
+	if (!pb_ready) {
+		for(i=0; i<PB_COUNT; i++)
+			pb_spare[i] = PB_COUNT - 1 - i;
+		pb_left = PB_COUNT;
+		pb_ready = 1;
+	}
+	if (!pb_left)
+		return NULL;
+	i = pb_spare[--pb_left];
+	pb_pool[i].pb_refs = 1;
+	return pb_pool[i].pb_data;
+}
+
+int pb_hold(p)
+SCH *p;
+{
+	int i;
+
+	i = pb_find(p);
+	if (i < 0 || !pb_pool[i].pb_refs)
+		return 0;
+	pb_pool[i].pb_refs++;
+	return 1;
+}
+
+int pb_free(p)
+SCH *p;
+{
+	int i;
+
+	i = pb_find(p);
+	if (i < 0 || !pb_pool[i].pb_refs)
+		return 0;
+	if (!--pb_pool[i].pb_refs)
+		pb_spare[pb_left++] = i;
+	return 1;
+}
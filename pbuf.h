@@ -0,0 +1,25 @@
+#if __GNUC__
+SCH *pb_get(void);
+int pb_hold(SCH *p);
+int pb_free(SCH *p);
+#else
+SCH *pb_get();
+int pb_hold();
+int pb_free();
+#endif
+
+extern int pb_left;
+
+/* how big each buffer is: a full-sized datagram (PACKET_SIZE in tcp.h).
+   there is one more byte past that for the padding slip_slurp() and the
+   builders may write. it can be smaller (say, 576) if memory is tight. */
+#ifndef PB_SIZE
+#define PB_SIZE		1536
+#endif
+
+/* how many buffers there are. a client needs about four at most (minisock:
+   a packet, a reply and tcp_twiddle()'s reply); the rest are
+   for datagrams demux.c is holding, of which there are at most DMX_SLOTS. */
+#ifndef PB_COUNT
+#define PB_COUNT	12
+#endif
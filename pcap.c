@@ -0,0 +1,288 @@
+/* pcap capture and replay for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * This writes every datagram the SLIP driver sends or receives to a
+ * classic pcap file (LINKTYPE_RAW, so each record is just the IPv4
+ * datagram) that Wireshark, tcpdump et al. can read, and reads such files
+ * back for the replay link (see link.c). Unlike the DEBUG hex dumps, this
+ * is cheap enough not to disturb the timing much: records are collected in
+ * a buffer and written out when it fills, when the capture is closed, or
+ * if we are killed by a signal (ping, for one, only stops that way).
+ *
+ * cap_open() starts a capture file, cap_write() adds a datagram to it with
+ * the current time (or cap_gather() one in pieces), and cap_close()
+ * finishes it.
+ * cap_play() opens a capture file for reading, cap_read() gets the next
+ * datagram from it, and cap_stop() closes it.
+ *
+ * Headers are written little-endian a byte at a time, so this doesn't
+ * care what the host is. Both byte orders are accepted when reading.
+ */
+
+#include "compat.h"
+#include "slip.h"
+#include "pcap.h"
+#include <signal.h>
+
+#ifndef CAP_BUF
+#define CAP_BUF	4096
+#endif
+SCH cap_buf[CAP_BUF];
+int cap_len = 0;
+int cap_out = -1;
+FILE *cap_in = NULL;
+int cap_swap = 0;	/* set if the file we're reading is big-endian */
+
+/* write out whatever we've collected. this only uses write(), so it is
+   safe to call from a signal handler. */
+int cap_flush()
+{
+	int i, j, n;
+
+	n = cap_len;
+	cap_len = 0;
+	for(i=0; i<n; i+=j) {
+		j = write(cap_out, cap_buf + i, n - i);
+		if (j <= 0)
+			return 0;
+	}
+	return 1;
+}
+
+/* on the way out, don't leave the tail of the capture behind */
+SIGTYPE cap_sig(sig)
+int sig;
+{
+	if (cap_out >= 0)
+		cap_flush();
+	signal(sig, SIG_DFL);
+	kill(getpid(), sig);
+}
+
+/* write a 32-bit little-endian value */
+int cap_long(v)
+B32 v;
+{
+	if (cap_len > CAP_BUF - 4)
+		cap_flush();
+	cap_buf[cap_len++] = v & 0xff;
+	cap_buf[cap_len++] = (v >> 8) & 0xff;
+	cap_buf[cap_len++] = (v >> 16) & 0xff;
+	cap_buf[cap_len++] = (v >> 24) & 0xff;
+	return 1;
+}
+
+/* read a 32-bit value in the file's byte order. returns zero at the end of
+   the file, which is never in the middle of a value in a good file. */
+int cap_grab(v)
+B32 *v;
+{
+	int i, c;
+	B32 n;
+
+	n = 0;
+	for(i=0; i<4; i++) {
+		c = getc(cap_in);
+		if (c == EOF)
+			return 0;
+		if (cap_swap)
+			n = (n << 8) | (c & 0xff);
+		else
+			n |= ((B32)(c & 0xff)) << (i * 8);
+	}
+	*v = n;
+	return 1;
+}
+
+/* start a new capture file */
+int cap_open(path)
+char *path;
+{
+	if (cap_out >= 0)
+		cap_close();
+#if IS_POSIX
+	cap_out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+	cap_out = creat(path, 0644);
+#endif
+	if (cap_out < 0) {
+		perror("cap_open");
+		return 0;
+	}
+	cap_len = 0;
+	signal(SIGHUP, cap_sig);
+	signal(SIGINT, cap_sig);
+	signal(SIGPIPE, cap_sig);
+	signal(SIGTERM, cap_sig);
+	cap_long((B32)0xa1b2c3d4L);	/* magic, microseconds */
+	cap_long(0x00040002L);		/* version 2.4 */
+	cap_long(0);			/* GMT */
+	cap_long(0);			/* accuracy */
+	cap_long(CAP_SNAP);
+	cap_long(CAP_RAW);
+	return 1;
+}
+
+/* add a datagram to the capture file, if there is one */
+int cap_write(payload, size)
+SCH *payload;
+int size;
+{
+	struct frag f;
+
+	f.fr_data = payload;
+	f.fr_size = size;
+	return cap_gather(&f, 1);
+}
+
+/* likewise, for one in n pieces (see slip_gather()) */
+int cap_gather(frag, n)
+struct frag *frag;
+int n;
+{
+	B32 sec, usec;
+	SCH *p;
+	int i, j, size;
+
+	if (cap_out < 0)
+		return 0;
+	size = 0;
+	for(j=0; j<n; j++)
+		size += frag[j].fr_size;
+#if IS_POSIX
+	{
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		sec = ts.tv_sec;
+		usec = ts.tv_nsec / 1000;
+	}
+#else
+	{
+		long ltime;
+
+		time(&ltime);
+		sec = ltime;
+		usec = 0;
+	}
+#endif
+	cap_long(sec);
+	cap_long(usec);
+	cap_long((B32)size);
+	cap_long((B32)size);
+	for(j=0; j<n; j++) {
+		p = frag[j].fr_data;
+		for(i=0; i<frag[j].fr_size; i++) {
+			if (cap_len == CAP_BUF && !cap_flush()) {
+				perror("cap_write");
+				cap_close();
+				return 0;
+			}
+			cap_buf[cap_len++] = p[i];
+		}
+	}
+	return 1;
+}
+
+int cap_close()
+{
+	if (cap_out < 0)
+		return 0;
+	signal(SIGHUP, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGPIPE, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	cap_flush();
+	close(cap_out);
+	cap_out = -1;
+	return 1;
+}
+
+/* open a capture file for reading. it must be IPv4 with no link header. */
+int cap_play(path)
+char *path;
+{
+	B32 v;
+	int i, c[4];
+
+	if (cap_in)
+		cap_stop();
+	cap_in = fopen(path, "r");
+	if (!cap_in) {
+		perror("cap_play");
+		return 0;
+	}
+	/* the magic number tells us the byte order. we take microsecond
+	   (a1b2c3d4) or nanosecond (a1b23c4d) timestamps, since we don't
+	   look at them anyway. */
+	for(i=0; i<4; i++)
+		c[i] = getc(cap_in);
+	if (c[0] == 0xa1 && c[1] == 0xb2 &&
+			((c[2] == 0xc3 && c[3] == 0xd4) ||
+			(c[2] == 0x3c && c[3] == 0x4d)))
+		cap_swap = 1;
+	else if (c[3] == 0xa1 && c[2] == 0xb2 &&
+			((c[1] == 0xc3 && c[0] == 0xd4) ||
+			(c[1] == 0x3c && c[0] == 0x4d)))
+		cap_swap = 0;
+	else
+		goto bad;
+	/* skip version, zone, accuracy and snap length */
+	for(i=0; i<4; i++) {
+		if (!cap_grab(&v))
+			goto bad;
+	}
+	if (!cap_grab(&v) || ((v & 0xffff) != CAP_RAW &&
+			(v & 0xffff) != CAP_IPV4))
+		goto bad;
+	return 1;
+
+bad:
+	fprintf(stderr, "cap_play: %s is not a raw IPv4 capture\n", path);
+	cap_stop();
+	return 0;
+}
+
+/* get the next datagram from the capture file into payload, which is size
+   bytes long. anything past that is skipped. returns the length, or zero
+   at the end of the file or if the record makes no sense. */
+int cap_read(payload, size)
+SCH *payload;
+int size;
+{
+	B32 len, v;
+	int i, c;
+
+	if (!cap_in)
+		return 0;
+	/* timestamp, which we ignore (replay goes as fast as it can) */
+	if (!cap_grab(&v) || !cap_grab(&v))
+		return 0;
+	if (!cap_grab(&len) || !cap_grab(&v))
+		return 0;
+	/* no IPv4 datagram is bigger than CAP_SNAP, and no more of one can
+	   be kept than it had */
+	if (len < 0 || len > CAP_SNAP || len > v) {
+		fprintf(stderr, "cap_read: bad record length %ld\n", (long)len);
+		return 0;
+	}
+	for(i=0; i<len; i++) {
+		c = getc(cap_in);
+		if (c == EOF)
+			return 0;
+		if (i < size)
+			payload[i] = c;
+	}
+	return (len < size) ? len : size;
+}
+
+int cap_stop()
+{
+	if (!cap_in)
+		return 0;
+	fclose(cap_in);
+	cap_in = NULL;
+	return 1;
+}
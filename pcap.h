@@ -0,0 +1,32 @@
+#if NO_PCAP
+/* built without it: there is no pcap= option or replay link */
+#define cap_open(p)	0
+#define cap_write(p, s)	((void)0)
+#define cap_gather(f, n)	((void)0)
+#define cap_close()	((void)0)
+#else
+#if __GNUC__
+int cap_open(char *path);
+int cap_write(SCH *payload, int size);
+int cap_gather(struct frag *frag, int n);
+int cap_play(char *path);
+int cap_read(SCH *payload, int size);
+#else
+int cap_open();
+int cap_write();
+int cap_gather();
+int cap_play();
+int cap_read();
+#endif
+int cap_close();
+int cap_stop();
+
+extern FILE *cap_in;
+#endif
+
+/* link types we write, and can read back */
+#define CAP_RAW		101	/* LINKTYPE_RAW, bare IPv4 or IPv6 */
+#define CAP_IPV4	228	/* LINKTYPE_IPV4 */
+
+/* how much of each datagram we keep */
+#define CAP_SNAP	65535
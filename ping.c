@@ -15,42 +15,71 @@
 
 #include "compat.h"
 #include "slip.h"
+#include "wheel.h"
+#include "demux.h"
+#include "pbuf.h"
+
+/* how long to wait for each reply, in ms */
+#ifndef PING_WAIT
+#define PING_WAIT 2000
+#endif
+
+/* the opaque identifier in our echo requests, which comes back in the
+   replies */
+#define PING_ID 0xe6c4L
 
 MAIN
 main(argc, argv)
 int argc;
 char **argv;
 {
-	int i;
+	int i, probe;
+	B32 rate;
 	B16 size;
 	/* RFC 6864 indicates that pretty much nothing relies on the
          * uniqueness of the IPv4 ID field anymore. */
 	B16 counter;
 	B16 checksum;
-	SCH *packet;
+	SCH *packet, *reply;
+	struct timer t;
 
+	/* link settings, if any, come first */
+	if (!slip_args(&argc, &argv))
+		exit(1);
+	/* -p probes for the fastest line rate before we start */
+	probe = 0;
+	if (argc > 1 && argv[1][0] == '-' && argv[1][1] == 'p' && !argv[1][2]) {
+		probe = 1;
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
 	if (argc != 9) {
-		fprintf(stderr, "usage: %s so ur ce ip re mo te ip\n", argv[0]);
+		fprintf(stderr, "usage: %s [-l link] [-p] so ur ce ip re mo te ip\n", argv[0]);
 		exit(1);
 	}
 
-	/* we clear the packet manually anyway, so don't bother with calloc */
-	packet = malloc(1536);
+	/* pool buffers aren't cleared, but we clear the packet manually anyway */
+	packet = pb_get();
 	if (!packet) {
-		perror("malloc");
+		fprintf(stderr, "out of packet buffers\n");
 		exit(2);
 	}
 
 	if (!slip_setup()) {
 		perror("SLIP failure");
-		free(packet);
+		pb_free(packet);
 		exit(3);
 	}
 
+	/* hold on to replies even if they turn up while something else is
+	   waiting */
+	dmx_want(DMX_ICMP, PING_ID);
+
 	/* ping loop starts here */
 	counter = 1;
-	size = 84; /* the packets we send are always this size */
 	for(;;) {
+		size = 84; /* the packets we send are always this size */
 		/* erase the packet */
 		slip_splat(packet, size);
 
@@ -100,8 +129,8 @@ char **argv;
 		packet[20] = 0x08; /* ICMP echo */
 		packet[21] = 0x00; /* ICMP code */
 		/* opaque identifier */
-		packet[24] = 0xe6;
-		packet[25] = 0xc4;
+		packet[24] = (PING_ID >> 8) & 0xff;
+		packet[25] = (PING_ID & 0xff);
 		/* sequence number */
 		packet[26] = (counter >> 8) & 0xff;
 		packet[27] = (counter & 0x00ff);
@@ -124,23 +153,56 @@ char **argv;
 		packet[22] = (checksum >> 8) & 0xff;
 		packet[23] = (checksum & 0x00ff); 
 
+		/* first time through, see how fast the line will go */
+		if (probe) {
+			probe = 0;
+			reply = pb_get();
+			if (!reply) {
+				fprintf(stderr, "out of packet buffers\n");
+				slip_stop();
+				pb_free(packet);
+				exit(2);
+			}
+			rate = slip_probe(packet, size, reply, PB_SIZE);
+			pb_free(reply);
+			if (rate)
+				fprintf(stdout, "line rate %ld bps\n", (long)rate);
+			else
+				fprintf(stdout, "line rate probe failed\n");
+		}
+
 		if(!slip_ship(packet, size)) {
 			perror("SLIP failure");
 			slip_stop();
-			free(packet);
+			pb_free(packet);
 			exit(3);
 		}
 
+		wheel_arm(&t, (B32)PING_WAIT, 0, 0);
 		for (;;) {
-			size = slip_slurp(packet, 1536);
-			/* reject non-ICMP */
-			if (packet[9] != 1) continue;
+			size = dmx_recv(packet, PB_SIZE, DMX_ICMP, PING_ID);
+			/* the alarm may be for some other timer */
+			if (!size && slip_fault == SLIP_TIMEOUT && t.tw_live)
+				continue;
+			/* it's an echo reply to us, or we wouldn't have it */
 			break;
 		}
+		wheel_drop(&t);
+		if (!size) {
+			if (slip_fault != SLIP_TIMEOUT) {
+				perror("SLIP failure");
+				slip_stop();
+				pb_free(packet);
+				exit(3);
+			}
+			fprintf(stdout, "request timed out\n");
+			sleep(1);
+			counter++;
+			continue;
+		}
 		/* check for mangled packets */
-		/* compute ICMP checksum (IP was already checked) */
-		checksum = slip_sum((packet + 20), size - 20);
-		if (checksum) {
+		/* ICMP checksum (IP was already checked) */
+		if (!slip_valid(packet, size)) {
 			fprintf(stdout, "mangled reply, retrying\n");
 		} else {
 			fprintf(stdout,
@@ -157,6 +219,6 @@ char **argv;
 	}
 
 	slip_stop();
-	free(packet);
+	pb_free(packet);
 	exit(0);
 }
@@ -0,0 +1,192 @@
+/* TCP receive queue for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * minisock used to take a segment only if it started exactly where the
+ * last one ended, and threw away anything that came early, which the other
+ * side then had to send again. Its window was one segment, so that was
+ * also all that could be on its way to us at once. Instead, what we receive
+ * goes in a sink (see slip.h), and the window is however much room is left
+ * in it. A segment that comes in order goes after what we have; one that
+ * comes early goes at its own place further on, and is held there until
+ * what comes before it arrives, when the whole run is in order at once.
+ *
+ * rq_start() sets up a sink. rq_take() takes the data of a valid segment,
+ * wherever slip_slurp() put it (straight into the sink, if it was diverted
+ * there, or else after its headers), and says how much more is now in
+ * order; your acknowledgement number is moved along by that much.
+ * rq_window() is the window to advertise, and rq_fin() notes where their
+ * FIN is, if a segment has it, and says when everything before it is in
+ * (a FIN can come early too). What
+ * is in order is the first sk_used bytes of sk_data; once you have written
+ * it out, rq_shift() moves anything held after it to the front.
+ *
+ * No more than SINK_RUNS runs are held at once. A segment that would need
+ * another is dropped, and has to be sent again.
+ */
+
+#include "compat.h"
+#include "slip.h"
+#include "tcp.h"
+#include "recvq.h"
+#include "trace.h"
+
+/* four big-endian bytes to a number */
+B32 rq_word(p)
+SCH *p;
+{
+	return ((B32)(p[0] & 0xff) << 24) | ((B32)(p[1] & 0xff) << 16) |
+		((B32)(p[2] & 0xff) << 8) | (B32)(p[3] & 0xff);
+}
+
+int rq_start(sk, data, size, peer, rport, port, ackno)
+struct sink *sk;
+SCH *data; /* buffer */
+int size; /* how big it is */
+SCH *peer; /* their 32 bit IPv4 address */
+B32 rport; /* their TCP port */
+B32 port; /* our TCP port */
+SCH *ackno; /* 32 bit acknowledgement number, moved along as data comes */
+{
+	sk->sk_data = data;
+	sk->sk_room = size;
+	sk->sk_used = 0;
+	sk->sk_got = 0;
+	sk->sk_off = 0;
+	sk->sk_port = port;
+	sk->sk_peer = peer;
+	sk->sk_rport = rport;
+	sk->sk_seqno = ackno;
+	sk->sk_runs = 0;
+	sk->sk_fin = -1;
+	return 1;
+}
+
+/* take the data of a valid TCP datagram of size bytes. returns how many
+   more bytes are in order because of it, which may be none. */
+int rq_take(sk, reply, size)
+struct sink *sk;
+SCH *reply;
+int size;
+{
+	int i, ihl, hlen, len, from, to, n;
+	B32 off;
+	SCH *data;
+
+	ihl = (reply[0] & 0x0f) << 2;
+	hlen = ihl + ((reply[ihl + 12] >> 2) & 0x3c);
+	len = size - hlen;
+	if (len < 1)
+		return 0;
+	if (sk->sk_got) {
+		/* slip_slurp() already put it where it goes */
+		off = sk->sk_off;
+		len = sk->sk_got;
+		sk->sk_got = 0;
+	} else {
+		/* it's after the headers. leave out what we already have
+		   and what there's no room for, and put the rest in place. */
+		data = reply + hlen;
+		off = rq_word(reply + ihl + 4) - rq_word(sk->sk_seqno);
+		if (off < 0) {
+			if (-off >= len)
+				return 0;
+			data -= off;
+			len += off;
+			off = 0;
+		}
+		if (off >= sk->sk_room - sk->sk_used)
+			return 0;
+		if (len > sk->sk_room - sk->sk_used - (int)off)
+			len = sk->sk_room - sk->sk_used - (int)off;
+		slip_move(sk->sk_data + sk->sk_used + (int)off, data, len);
+	}
+
+	/* join it up with any runs it touches */
+	from = off;
+	to = from + len;
+	for(i=0; i<sk->sk_runs; ) {
+		if (sk->sk_to[i] < from || sk->sk_from[i] > to) {
+			i++;
+			continue;
+		}
+		if (sk->sk_from[i] < from)
+			from = sk->sk_from[i];
+		if (sk->sk_to[i] > to)
+			to = sk->sk_to[i];
+		sk->sk_runs--;
+		sk->sk_from[i] = sk->sk_from[sk->sk_runs];
+		sk->sk_to[i] = sk->sk_to[sk->sk_runs];
+	}
+
+	/* not next, so hold it, if we can */
+	if (from) {
+		if (sk->sk_runs == SINK_RUNS)
+			return 0;
+		TRACE(TR_HOLD, from, to - from);
+		sk->sk_from[sk->sk_runs] = from;
+		sk->sk_to[sk->sk_runs++] = to;
+		return 0;
+	}
+
+	/* it's next: everything up to to is in order now. what's held is
+	   counted from the new end of that. */
+	sk->sk_used += to;
+	for(i=0; i<sk->sk_runs; i++) {
+		sk->sk_from[i] -= to;
+		sk->sk_to[i] -= to;
+	}
+	if (sk->sk_fin >= to)
+		sk->sk_fin -= to;
+	/* (tcp_total32() only adds 16 bits at a time) */
+	for(n=to; n>0; n-=i) {
+		i = (n > 16384) ? 16384 : n;
+		tcp_total32(sk->sk_seqno, i);
+	}
+	return to;
+}
+
+/* if this valid TCP datagram has FIN, remember where it goes. returns 1
+   once everything before the FIN is in order, so it can be taken. */
+int rq_fin(sk, reply, size)
+struct sink *sk;
+SCH *reply;
+int size;
+{
+	int ihl, hlen;
+	B32 off;
+
+	ihl = (reply[0] & 0x0f) << 2;
+	if (reply[ihl + 13] & 1) {
+		hlen = ihl + ((reply[ihl + 12] >> 2) & 0x3c);
+		off = rq_word(reply + ihl + 4) + (B32)(size - hlen) -
+			rq_word(sk->sk_seqno);
+		if (off >= 0 && off <= sk->sk_room - sk->sk_used)
+			sk->sk_fin = off;
+	}
+	return (sk->sk_fin == 0);
+}
+
+/* forget what's in order, once you've written it out, and move what's held
+   after it to the front */
+int rq_shift(sk)
+struct sink *sk;
+{
+	int i, n;
+	SCH *p;
+
+	if (!sk->sk_used)
+		return 1;
+	n = 0;
+	for(i=0; i<sk->sk_runs; i++) {
+		if (sk->sk_to[i] > n)
+			n = sk->sk_to[i];
+	}
+	/* a byte at a time, front to back, since they may overlap */
+	p = sk->sk_data + sk->sk_used;
+	for(i=0; i<n; i++)
+		sk->sk_data[i] = p[i];
+	sk->sk_used = 0;
+	return 1;
+}
@@ -0,0 +1,14 @@
+#if __GNUC__
+int rq_start(struct sink *sk, SCH *data, int size, SCH *peer, B32 rport, B32 port, SCH *ackno);
+int rq_take(struct sink *sk, SCH *reply, int size);
+int rq_fin(struct sink *sk, SCH *reply, int size);
+int rq_shift(struct sink *sk);
+#else
+int rq_start();
+int rq_take();
+int rq_fin();
+int rq_shift();
+#endif
+
+/* how much more they can send us: our receive window */
+#define rq_window(sk)	((B32)((sk)->sk_room - (sk)->sk_used))
@@ -0,0 +1,333 @@
+/* TCP send queue for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * minisock used to send everything it had in one datagram, which had to
+ * fit in our MSS, and then wait for it to be acknowledged before doing
+ * anything else. Instead, what we send is a stream: some pieces already
+ * in memory (such as strings from the command line), then, if you like,
+ * whatever can be read from a file descriptor. It goes out in segments of
+ * up to MSS_WINDOW bytes, as many at once as the other side's window has
+ * room for, and each acknowledgement moves it along. If the retransmission
+ * timer goes off, we go back to the oldest byte they haven't acknowledged
+ * and start again from there a segment at a time, with one more allowed in
+ * flight for each ACK, in case it was the line that couldn't keep up.
+ * The timeout comes from how long segments take to be acknowledged: one
+ * segment at a time is timed, never one that has been sent again (Karn's
+ * rule), and each time the timer goes off it waits twice as long.
+ *
+ * sq_start() sets up a queue for a connection that has finished its
+ * handshake. sq_send() sends whatever the window allows; call it each time
+ * around your receive loop, and slip_sweep() after. sq_ack() takes the ACK
+ * and window from a reply. sq_seq() works out the sequence number of a
+ * position in the stream, such as sq_nxt, which is what your own ACKs
+ * should carry. Every segment carries the acknowledgement number too, and
+ * sq_sent is set when one goes out, so you know you needn't send an ACK of
+ * your own. sq_done() says when it has all been sent and acknowledged.
+ * sq_skip() passes over what the other side already has, such as data it
+ * took with the SYN. sq_close() says to send a FIN after the last of it, so
+ * the other side knows there's no more; it takes up a place in the stream
+ * after sq_end, and is sent again like anything else that isn't
+ * acknowledged. sq_shut() says when it has gone.
+ *
+ * The pieces are sent from where they are, so they have to stay put
+ * until then. What is read from the file descriptor is kept in sq_ring
+ * until it is acknowledged, so no more than SQ_RING bytes of it are in
+ * flight at once. Reads block, so this suits files and pipes that keep
+ * up better than something typed in. If the descriptor doesn't block and
+ * has nothing yet, sq_poll goes off in SQ_POLL ms so you come round and
+ * try again.
+ */
+
+#include "compat.h"
+#include "slip.h"
+#include "tcp.h"
+#include "wheel.h"
+#include "sendq.h"
+#include "trace.h"
+
+/* four big-endian bytes to a number */
+B32 sq_word(p)
+SCH *p;
+{
+	return ((B32)(p[0] & 0xff) << 24) | ((B32)(p[1] & 0xff) << 16) |
+		((B32)(p[2] & 0xff) << 8) | (B32)(p[3] & 0xff);
+}
+
+int sq_start(sq, tc, seqno, ackno, src, n, fd)
+struct sendq *sq;
+struct tcb *tc; /* connection from tcp_prime() */
+SCH *seqno; /* 32 bit sequence number of the first byte */
+SCH *ackno; /* 32 bit acknowledgement number, which we follow */
+struct frag *src; /* pieces to send first */
+int n; /* how many */
+int fd; /* file descriptor to read the rest from, or -1 */
+{
+	int i;
+
+	sq->sq_tc = tc;
+	sq->sq_ackno = ackno;
+	sq->sq_iss = sq_word(seqno);
+	sq->sq_src = src;
+	sq->sq_srcs = n;
+	sq->sq_flen = 0;
+	for(i=0; i<n; i++)
+		sq->sq_flen += src[i].fr_size;
+	sq->sq_fd = fd;
+	sq->sq_eof = (fd < 0);
+	sq->sq_fin = 0;
+	sq->sq_una = 0;
+	sq->sq_nxt = 0;
+	sq->sq_max = 0;
+	sq->sq_end = sq->sq_flen;
+	/* until they tell us otherwise, one segment at a time */
+	sq->sq_wnd = MSS_WINDOW;
+	sq->sq_cwnd = SQ_START;
+	sq->sq_tries = 0;
+	sq->sq_sent = 0;
+	sq->sq_rtat = -1;
+	sq->sq_err = 0;
+	sq->sq_timer.tw_live = 0;
+	sq->sq_poll.tw_live = 0;
+	return 1;
+}
+
+/* the first n bytes, which must be from the pieces in memory, have been
+   sent and acknowledged already (say, with the SYN) */
+int sq_skip(sq, n)
+struct sendq *sq;
+B32 n;
+{
+	if (n < 0 || n > sq->sq_flen)
+		return 0;
+	sq->sq_una = n;
+	sq->sq_nxt = n;
+	sq->sq_max = n;
+	return 1;
+}
+
+/* send a FIN once everything has been sent */
+int sq_close(sq)
+struct sendq *sq;
+{
+	sq->sq_fin = 1;
+	return 1;
+}
+
+/* put the sequence number of position at into seqno */
+int sq_seq(sq, at, seqno)
+struct sendq *sq;
+B32 at;
+SCH *seqno;
+{
+	B32 v;
+
+	v = sq->sq_iss + at;
+	seqno[0] = (v >> 24) & 0xff;
+	seqno[1] = (v >> 16) & 0xff;
+	seqno[2] = (v >> 8) & 0xff;
+	seqno[3] = v & 0xff;
+	return 1;
+}
+
+/* read what we can from the file into the ring, if there's room. returns
+   zero, with sq_err set, if the read fails. */
+int sq_fill(sq)
+struct sendq *sq;
+{
+	int at, k;
+	B32 low;
+
+	if (sq->sq_eof || sq->sq_poll.tw_live)
+		return 1;
+	/* keep everything not yet acknowledged */
+	low = (sq->sq_una > sq->sq_flen) ? sq->sq_una : sq->sq_flen;
+	k = SQ_RING - (int)(sq->sq_end - low);
+	if (k <= 0)
+		return 1;
+	at = (int)((sq->sq_end - sq->sq_flen) % SQ_RING);
+	if (k > SQ_RING - at)
+		k = SQ_RING - at;
+	k = read(sq->sq_fd, sq->sq_ring + at, k);
+#if IS_POSIX
+	/* interrupted, or nothing there yet */
+	if (k < 0 && errno == EINTR)
+		return sq_fill(sq);
+	if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		wheel_arm(&sq->sq_poll, (B32)SQ_POLL, 0, 0);
+		return 1;
+	}
+#endif
+	if (k < 0) {
+		sq->sq_eof = 1;
+		sq->sq_err = TCP_READ_ERROR;
+		return 0;
+	}
+	if (k == 0)
+		sq->sq_eof = 1;
+	sq->sq_end += k;
+	return 1;
+}
+
+/* send up to len bytes from position at, as one segment. it may be cut
+   short if it would be in too many pieces. if that's the end of it, and
+   there's no more to come, the FIN goes too (and len may be zero). returns
+   how many places in the stream went, or zero if it couldn't be sent. */
+int sq_emit(sq, at, len)
+struct sendq *sq;
+B32 at;
+int len;
+{
+	struct frag f[SQ_FRAGS + 1];
+	SCH seqno[4];
+	int i, k, n, want;
+	B32 p;
+
+	n = 1;
+	f[0].fr_data = sq->sq_head;
+	want = len;
+	/* first from the pieces in memory */
+	p = 0;
+	for(i=0; i<sq->sq_srcs && want && n<=SQ_FRAGS; i++) {
+		k = sq->sq_src[i].fr_size;
+		if (at < p + k) {
+			f[n].fr_data = sq->sq_src[i].fr_data + (int)(at - p);
+			f[n].fr_size = (int)(p + k - at);
+			if (f[n].fr_size > want)
+				f[n].fr_size = want;
+			at += f[n].fr_size;
+			want -= f[n++].fr_size;
+		}
+		p += k;
+	}
+	/* then from the ring, which may wrap around */
+	while (want && n<=SQ_FRAGS) {
+		k = (int)((at - sq->sq_flen) % SQ_RING);
+		f[n].fr_data = sq->sq_ring + k;
+		f[n].fr_size = (want < SQ_RING - k) ? want : SQ_RING - k;
+		at += f[n].fr_size;
+		want -= f[n++].fr_size;
+	}
+	len -= want;
+
+	/* push when this is all we have, and close if it's all there is */
+	sq_seq(sq, at - len, seqno);
+	k = (at == sq->sq_end) ? (16 | 8) : 16;
+	if (at == sq->sq_end && sq->sq_eof && sq->sq_fin) {
+		k |= 1;
+		len++;
+	}
+	if (!tcp_gather(sq->sq_tc, f, k, seqno, sq->sq_ackno, n) ||
+			!slip_gather(f, n)) {
+		sq->sq_err = TCP_SLIP_ERROR;
+		return 0;
+	}
+	sq->sq_sent = 1;
+	return len;
+}
+
+int sq_send(sq)
+struct sendq *sq;
+{
+	int k;
+	B32 w;
+
+	if (!sq_fill(sq))
+		return 0;
+
+	/* if the timer has gone off, they've lost the oldest segment (or
+	   its ACK), so go back and send from there again, one at a time */
+	if (sq->sq_una != sq->sq_nxt && !sq->sq_timer.tw_live) {
+		if (sq->sq_tries++ >= TCP_TRIES) {
+			TRACE(TR_TIMEOUT, TCP_TRIES, 0);
+			sq->sq_err = TCP_TIMEOUT;
+			return 0;
+		}
+		TRACE(TR_REXMIT, sq->sq_tries, sq->sq_nxt - sq->sq_una);
+		sq->sq_nxt = sq->sq_una;
+		sq->sq_cwnd = MSS_WINDOW;
+		/* wait longer this time, and don't time what's sent again */
+		tcp_backoff(sq->sq_tc);
+		sq->sq_rtat = -1;
+	}
+
+	/* then whatever their window (and ours) has room for. if theirs
+	   is shut, send a byte anyway once everything else is acknowledged,
+	   and again every time the timer goes off, to see when it opens. a
+	   FIN we're to send comes last, with the last of the data if it
+	   fits. */
+	while (sq->sq_nxt < sq->sq_end || (sq->sq_eof && sq->sq_fin &&
+			sq->sq_nxt == sq->sq_end)) {
+		w = (sq->sq_wnd < sq->sq_cwnd) ? sq->sq_wnd : sq->sq_cwnd;
+		w -= sq->sq_nxt - sq->sq_una;
+		if (w <= 0) {
+			if (sq->sq_nxt != sq->sq_una)
+				break;
+			w = 1;
+		}
+		if (w > sq->sq_end - sq->sq_nxt)
+			w = sq->sq_end - sq->sq_nxt;
+		k = (w < MSS_WINDOW) ? (int)w : MSS_WINDOW;
+		k = sq_emit(sq, sq->sq_nxt, k);
+		if (!k)
+			return 0;
+		/* time it, if it's the first time it's gone and we aren't
+		   timing one already */
+		if (sq->sq_rtat < 0 && sq->sq_nxt >= sq->sq_max) {
+			sq->sq_rtat = sq->sq_nxt + k;
+			sq->sq_rtwhen = wheel_now();
+		}
+		sq->sq_nxt += k;
+		if (sq->sq_nxt > sq->sq_max)
+			sq->sq_max = sq->sq_nxt;
+		if (!sq->sq_timer.tw_live)
+			wheel_arm(&sq->sq_timer, sq->sq_tc->tc_rto, 0, 0);
+		if (!sq_fill(sq))
+			return 0;
+	}
+	return 1;
+}
+
+/* take the ACK and window from a reply (a valid TCP datagram with ACK
+   set). returns 1 if it acknowledged anything new. */
+int sq_ack(sq, reply)
+struct sendq *sq;
+SCH *reply;
+{
+	int hlen;
+	B32 a;
+
+	hlen = (reply[0] & 0x0f) << 2;
+	a = sq_word(reply + hlen + 8) - sq->sq_iss;
+	/* an old one, or for something we haven't sent. (if we've gone
+	   back, it may be for something we sent before that.) */
+	if (a < sq->sq_una || a > sq->sq_max)
+		return 0;
+	sq->sq_wnd = (B32)(reply[hlen + 14] & 0xff) << 8;
+	sq->sq_wnd |= reply[hlen + 15] & 0xff;
+	if (sq->sq_tc->tc_sscale > 0)
+		sq->sq_wnd <<= sq->sq_tc->tc_sscale;
+	if (a == sq->sq_una) {
+		/* they're still there, but their window is shut */
+		if (!sq->sq_wnd)
+			sq->sq_tries = 0;
+		return 0;
+	}
+	sq->sq_una = a;
+	if (sq->sq_nxt < a)
+		sq->sq_nxt = a;
+	if (sq->sq_rtat >= 0 && a >= sq->sq_rtat) {
+		tcp_measure(sq->sq_tc, wheel_now() - sq->sq_rtwhen);
+		sq->sq_rtat = -1;
+	}
+	if (sq->sq_cwnd < SQ_RING)
+		sq->sq_cwnd += MSS_WINDOW;
+	sq->sq_tries = 0;
+	/* start the timer again for what's left, if anything */
+	if (sq->sq_una == sq->sq_nxt)
+		wheel_drop(&sq->sq_timer);
+	else
+		wheel_arm(&sq->sq_timer, sq->sq_tc->tc_rto, 0, 0);
+	return 1;
+}
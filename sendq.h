@@ -0,0 +1,78 @@
+/* how much of a file we keep around until it's acknowledged. this is
+   also the most of it that can be in flight at once. */
+#ifndef SQ_RING
+#define SQ_RING		(4 * MSS_WINDOW)
+#endif
+
+/* how much we let be in flight to begin with. each ACK lets us have a
+   segment more, up to SQ_RING, and after a timeout we start again from
+   one (see sq_send()). the timeout is the connection's (see
+   tcp_measure()). */
+#ifndef SQ_START
+#define SQ_START	(2 * MSS_WINDOW)
+#endif
+
+/* how long in ms to wait before trying a file descriptor again that had
+   nothing for us yet (say, a terminal that doesn't block) */
+#ifndef SQ_POLL
+#define SQ_POLL		50
+#endif
+
+/* the most pieces a segment is gathered from (see slip_gather()), less
+   its headers. a segment that would need more is cut short. */
+#ifndef SQ_FRAGS
+#define SQ_FRAGS	16
+#endif
+
+/* a byte stream going out over a connection, set up by sq_start(). it is
+   the pieces in sq_src, then whatever can be read from sq_fd. positions in
+   it count from zero at sq_iss. */
+struct sendq {
+	struct tcb *sq_tc;	/* connection, from tcp_prime() */
+	SCH *sq_ackno;		/* 32 bit ackno to send with, kept up to date */
+	B32 sq_iss;		/* sequence number of the first byte */
+	struct frag *sq_src;	/* the stream starts with these */
+	int sq_srcs;
+	B32 sq_flen;		/* which are this long in all */
+	int sq_fd;		/* then this, or -1 */
+	int sq_eof;		/* set when there's no more */
+	int sq_fin;		/* set if a FIN follows it (sq_close()) */
+	B32 sq_una;		/* oldest byte they haven't acknowledged */
+	B32 sq_nxt;		/* next byte to send */
+	B32 sq_max;		/* most we've ever sent */
+	B32 sq_end;		/* how much of the stream we have */
+	B32 sq_wnd;		/* their window, as of their last ACK */
+	B32 sq_cwnd;		/* our own limit on what's in flight */
+	int sq_tries;		/* times the oldest has been sent again */
+	int sq_sent;		/* set when a segment goes out; clear it */
+	B32 sq_rtat;		/* end of the segment being timed, or -1 */
+	B32 sq_rtwhen;		/* when it was sent */
+	int sq_err;		/* TCP_TIMEOUT, TCP_SLIP_ERROR or
+				   TCP_READ_ERROR on failure */
+	struct timer sq_timer;	/* retransmission */
+	struct timer sq_poll;	/* when to try sq_fd again */
+	SCH sq_head[TCP_CONTROL];	/* headers for each segment */
+	SCH sq_ring[SQ_RING];	/* what we read from sq_fd */
+};
+
+#if __GNUC__
+int sq_start(struct sendq *sq, struct tcb *tc, SCH *seqno, SCH *ackno, struct frag *src, int n, int fd);
+int sq_send(struct sendq *sq);
+int sq_ack(struct sendq *sq, SCH *reply);
+int sq_seq(struct sendq *sq, B32 at, SCH *seqno);
+int sq_skip(struct sendq *sq, B32 n);
+int sq_close(struct sendq *sq);
+#else
+int sq_start();
+int sq_send();
+int sq_ack();
+int sq_seq();
+int sq_skip();
+int sq_close();
+#endif
+
+/* everything has been sent and acknowledged, FIN and all */
+#define sq_done(sq)	((sq)->sq_eof && \
+				(sq)->sq_una == (sq)->sq_end + (sq)->sq_fin)
+/* the FIN has been sent, if not acknowledged */
+#define sq_shut(sq)	((sq)->sq_fin && (sq)->sq_max > (sq)->sq_end)
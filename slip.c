@@ -5,8 +5,9 @@
  *
  * This is the system-dependent SLIP driver for BASS. It expects to be
  * directly connected to its host using slattach or Slirp or similar. It
- * does not currently support CSLIP. It also contains utility functions
- * for clearing and checksumming packets.
+ * supports CSLIP (see cslip.c), by default only once the other side starts
+ * using it. It also contains utility functions for clearing and
+ * checksumming packets.
  *
  * slip_setup() is called to initialize the connection.
  * slip_splat() clears a packet to zeroes. If you have memset() or bzero()
@@ -14,22 +15,61 @@
  * slip_sum() checksums a packet using the RFC algorithm. It can be used for
  * other protocols like UDP and TCP by adjusting the start and length, and
  * making any changes needed for those protocols' pseudoheaders. It returns
- * the checksum as a 16-bit int.
- * slip_slurp() waits for a complete packet and verifies length and checksum.
+ * the checksum as a 16-bit int. slip_part() does the same in pieces. With
+ * gcc or clang this adds up whole machine words (or SSE2/AVX2 vectors) at a
+ * time; define SLOW_SUM to use the portable reference version instead.
+ * slip_mend() changes a few bytes of a checksummed packet and adjusts the
+ * checksum to match (RFC 1624).
+ * slip_ship() encodes a datagram for SLIP and writes it out. slip_sack()
+ * encodes it into a staging buffer instead, and slip_sweep() writes out
+ * everything staged so far in one go. slip_gather() stages a datagram that
+ * is in several pieces (say, headers in one buffer and data in others)
+ * without putting it together first, and slip_frag() adds up the pieces for
+ * its checksums. Every way, slip_clean() finds runs that need no escaping
+ * (with gcc or clang, a word or SSE2/AVX2 vector at a time; define
+ * SLOW_SCAN to go a byte at a time), which are copied whole.
+ * slip_slurp() waits for a complete packet and verifies length and checksum,
+ * or for a timer (see wheel.c) to sound the alarm.
  * A packet returned from this function can be assumed to be valid. It returns
- * the number of bytes received.
+ * the number of bytes received. Garbage is skipped up to the next SLIP END
+ * and counted in slip_resyncs. The line is read in bulk into a receive
+ * buffer, and anything received past the end of the packet is kept for the
+ * next call; runs in it without END or ESC are copied out whole. The
+ * checksum is added up as the frame is unescaped, and the sums of the IP
+ * header and of the rest are left in slip_hsum and slip_psum, so callers
+ * don't have to go over the datagram again.
+ * slip_valid() uses them to check a TCP, UDP or ICMP checksum without
+ * writing a pseudo-header over the IP header.
+ * slip_divert() gives slip_slurp() a sink (see slip.h) for the data of the
+ * segments of a TCP connection that fall in its window: only their headers
+ * go in the buffer, and the data is decoded straight into the sink, at its
+ * place in the stream, where the caller can take it once slip_valid() says
+ * it's good (see recvq.c). If it isn't, nothing is taken, so the next
+ * segment just goes over it.
  * slip_stop() halts the SLIP link.
  *
- * As written, this hardcodes paths and bitrates. You should modify it for
- * your local system. When compiling with gcc/clang, it will use /dev/ttyUSB0
- * at 4800bps. When compiled for Venix, it will use /dev/lp at 4800bps.
+ * slip_config() sets the device and line settings from a specification
+ * string, and slip_args() does the same from a -l option on the command
+ * line. slip_probe() tries to step up the line rate.
  *
- * Only this file and compat.h should contain anything system-dependent
- * (ignoring time-related features of ntp.c).
+ * By default, when compiling with gcc/clang, it will use /dev/ttyUSB0 at
+ * 4800bps. When compiled for Venix, it will use /dev/lp at 4800bps. You can
+ * change these defaults by defining OUTPUT and BAUD (or USE_STDOUT, for
+ * standard input and output), or at run time with slip_config(), the -l
+ * option or the BASS_LINK environment variable. The link need not be a
+ * serial port; see link.c for the others.
+ *
+ * Only this file, link.c, wheel.c and compat.h should contain anything
+ * system-dependent (ignoring time-related features of ntp.c).
  */
 
 #include "compat.h"
 #include "slip.h"
+#include "cslip.h"
+#include "wheel.h"
+#include "link.h"
+#include "pcap.h"
+#include "trace.h"
 
 /* #define USE_STDOUT	1 */
 /* #define NO_ESCAPE	1 */
@@ -40,6 +80,13 @@
 #include <sgtty.h>
 #define OUTPUT	"/dev/lp"
 #endif
+#if USE_STDOUT
+#undef OUTPUT
+#define OUTPUT	"stdio"
+#endif
+#ifndef BAUD
+#define BAUD	4800
+#endif
 
 #define	SLIP_END	0xc0
 #define	SLIP_ESC	0xdb
@@ -50,73 +97,420 @@
 
 /* 192, 219, 220, 221 or -64, -37, -36, -35 */
 
-SCH slip_end[2] = { SLIP_ESC, SLIP_NDE };
-SCH slip_esc[2] = { SLIP_ESC, SLIP_SCE };
-SCH slip_done[1] = { SLIP_END };
+/* line settings, see slip_config() */
+#define SLIP_SPEC	128
+char slip_lspec[SLIP_SPEC];
+char *slip_device = OUTPUT;
+B32 slip_baud = BAUD;
+int slip_flow = 0;	/* RTS/CTS hardware flow control */
+int slip_vmin = 1;	/* termios read tuning, see slip_tty() */
+int slip_vtime = 0;
+int slip_block = 0;	/* if set, don't make the descriptor non-blocking */
+int slip_given = 0;	/* set if slip_config() was called */
+char *slip_pcap = 0;	/* capture file, see pcap.c */
+char *slip_trace = 0;	/* trace dump file, see trace.c */
 
-int fd = -1;
+/* line rates we know, slowest first, for slip_probe() */
+B32 slip_rates[] = { 300, 1200, 2400, 4800, 9600, 19200, 38400, 57600,
+	115200, 230400, 460800, 921600, 0 };
 
-int slip_setup()
+/* transmit staging buffer, see slip_sack() */
+#ifndef SLIP_OBUF
+#define SLIP_OBUF	1024
+#endif
+SCH slip_obuf[SLIP_OBUF];
+int slip_olen = 0;
+/* compressed header, see slip_sack() */
+SCH slip_vjhdr[CSLIP_HDR];
+
+/* receive buffer. we read as much as the line will give us at once and
+   keep whatever is left over past the current frame for the next call. */
+#ifndef SLIP_IBUF
+#define SLIP_IBUF	1024
+#endif
+SCH slip_ibuf[SLIP_IBUF];
+int slip_ihead = 0;
+int slip_itail = 0;
+
+/* receive framing states */
+#define SLIP_RX_DATA	0	/* collecting a frame */
+#define SLIP_RX_ESC	1	/* last byte was an ESC */
+#define SLIP_RX_TOSS	2	/* junking everything up to the next END */
+
+/* frames discarded as garbage, see slip_slurp() */
+int slip_resyncs = 0;
+
+/* why the last call failed, see slip.h */
+int slip_fault = 0;
+
+/* partial checksums of the last datagram received (see slip_slurp()) */
+B32 slip_hsum = 0;
+B32 slip_psum = 0;
+
+/* time allowed to finish a frame when a timer goes off partway through */
+struct timer slip_grace;
+
+/* where in-order TCP data goes, if anywhere (see slip_divert()) */
+struct sink *slip_sink = NULL;
+
+/* turn a line rate in bps into whatever the tty driver wants, or -1 if
+   it doesn't know it */
+B32 slip_bcode(baud)
+B32 baud;
 {
-#if USE_STDOUT
-	srand(time(NULL));
-	fd = 1;
-#else
-#if IS_POSIX
-	srand(time(NULL));
-	fd = open(OUTPUT, O_RDWR | O_NOCTTY | O_SYNC );
-	if (fd < 0) {
-		perror("slip_setup failed: open");
+#ifdef B300
+	if (baud == 300) return B300;
+#endif
+#ifdef B1200
+	if (baud == 1200) return B1200;
+#endif
+#ifdef B2400
+	if (baud == 2400) return B2400;
+#endif
+#ifdef B4800
+	if (baud == 4800) return B4800;
+#endif
+#ifdef B9600
+	if (baud == 9600) return B9600;
+#endif
+#ifdef B19200
+	if (baud == 19200) return B19200;
+#endif
+#ifdef B38400
+	if (baud == 38400) return B38400;
+#endif
+#ifdef B57600
+	if (baud == 57600) return B57600;
+#endif
+#ifdef B115200
+	if (baud == 115200) return B115200;
+#endif
+#ifdef B230400
+	if (baud == 230400) return B230400;
+#endif
+#ifdef B460800
+	if (baud == 460800) return B460800;
+#endif
+#ifdef B921600
+	if (baud == 921600) return B921600;
+#endif
+	return -1;
+}
+
+/* apply the current line settings to the open tty (see link.c) */
+int slip_tty()
+{
+	B32 code;
+
+	code = slip_bcode(slip_baud);
+	if (code < 0) {
+		fprintf(stderr, "slip: unsupported line rate %ld\n",
+			(long)slip_baud);
 		return 0;
-	} else {
+	}
+#if IS_POSIX
+	{
 		struct termios ttya;
 
 		memset(&ttya, 0, sizeof(ttya));
 		/* eat it! eat it raw! */
 		ttya.c_cflag = (CS8 | CREAD | CLOCAL); /* 8N1 */
-		ttya.c_cc[VTIME] = 0;
-		ttya.c_cc[VMIN] = 1; /* intentional blocking read for testing */
-		cfsetospeed(&ttya, B4800);
-		cfsetispeed(&ttya, B4800);
-		tcsetattr(fd, TCSANOW, &ttya);
-		tcflush(fd, TCIOFLUSH);
+		if (slip_flow) {
+#ifdef CRTSCTS
+			ttya.c_cflag |= CRTSCTS;
+#else
+			fprintf(stderr, "slip: no hardware flow control\n");
+			return 0;
+#endif
+		}
+		/* by default, block until at least one byte is ready, but
+		   then return everything the driver has, up to the size of
+		   our buffer */
+		ttya.c_cc[VTIME] = slip_vtime;
+		ttya.c_cc[VMIN] = slip_vmin;
+		cfsetospeed(&ttya, code);
+		cfsetispeed(&ttya, code);
+		if (tcsetattr(link_rfd, TCSANOW, &ttya)) {
+			perror("slip_setup failed: tcsetattr");
+			return 0;
+		}
+		tcflush(link_rfd, TCIOFLUSH);
 	}
 #else
-	fd = open(OUTPUT, OPEN_RW);
-	if (fd < 0) {
-		perror("slip_setup failed: open");
-		return 0;
-	} else {
 #if VENIX
+	{
 		struct sgttyb ttybuf;
-		long ltime;
-		int itime;
 
-		/* you can't just srand(time(NULL)) */
-		time(&ltime);
-		itime = ltime;
-		srand(itime);
-
-		ioctl(fd, TIOCGETP, &ttybuf);	
+		if (slip_flow) {
+			fprintf(stderr, "slip: no hardware flow control\n");
+			return 0;
+		}
+		ioctl(link_rfd, TIOCGETP, &ttybuf);	
 		/* paranoia */
-		ttybuf.sg_ispeed = B4800;
-		ttybuf.sg_ospeed = B4800;
+		ttybuf.sg_ispeed = code;
+		ttybuf.sg_ospeed = code;
 		/* eat it! eat it raw! (see TTY(7)) */
 		ttybuf.sg_flags = RAW;
 		/* this autoflushes */
-		ioctl(fd, TIOCSETP, &ttybuf);
+		ioctl(link_rfd, TIOCSETP, &ttybuf);
 
 		/* NB: a fashion of non-blocking I/O is available with */
 		/* TIOCQCNT and sg_ispeed/sg_ospeed, but we don't use it */
+	}
 #else
 you_should_probably_define_something_here;
 #endif
+#endif
+	/* anything we had buffered was at the old settings */
+	slip_ihead = 0;
+	slip_itail = 0;
+	return 1;
+}
+
+/* if s starts with w, return what follows it */
+char *slip_word(s, w)
+char *s;
+char *w;
+{
+	while (*w) {
+		if (*s++ != *w++)
+			return 0;
+	}
+	return s;
+}
+
+/* decimal to 32 bits, since atoi() may not be wide enough */
+B32 slip_num(s)
+char *s;
+{
+	B32 n = 0;
+
+	if (!s || *s < '0' || *s > '9')
+		return -1;
+	while (*s >= '0' && *s <= '9')
+		n = (n * 10) + (*s++ - '0');
+	if (*s)
+		return -1;
+	return n;
+}
+
+/* set up the link from a specification: the device (or another kind of
+   link, see link.c), then any of these, separated by commas: a line rate
+   in bps, rtscts for hardware flow control, block to leave the descriptor
+   blocking, vmin=n and vtime=n to tune termios reads (which only matter if
+   it is), cslip=off, on or auto, pcap=file to capture every datagram sent
+   and received, and trace=file to trace events to file (the last three
+   aren't there if built without them, see the Makefile). for example,
+   /dev/ttyS0,115200,rtscts. this must be called before slip_setup(); if
+   it isn't, slip_setup() uses BASS_LINK from the environment, if set. */
+int slip_config(spec)
+char *spec;
+{
+	char *p, *q;
+	B32 n;
+	int i;
+
+	if (!spec || !*spec)
+		return 0;
+	/* copy it so we can chop it up */
+	for(i=0; spec[i] && i<(SLIP_SPEC - 1); i++)
+		slip_lspec[i] = spec[i];
+	slip_lspec[i] = 0;
+	slip_given = 1;
+
+	slip_device = slip_lspec;
+	for(p=slip_lspec; *p; ) {
+		/* chop off the next field */
+		for(q=p; *q && *q != ','; q++);
+		if (*q)
+			*q++ = 0;
+		if (p != slip_lspec) {
+			if (*p >= '0' && *p <= '9') {
+				n = slip_num(p);
+				if (slip_bcode(n) < 0) {
+					fprintf(stderr,
+					"slip: unsupported line rate %s\n", p);
+					return 0;
+				}
+				slip_baud = n;
+			} else if (slip_word(p, "rtscts") &&
+					!*slip_word(p, "rtscts")) {
+				slip_flow = 1;
+			} else if (slip_word(p, "block") &&
+					!*slip_word(p, "block")) {
+				slip_block = 1;
+			} else if (slip_word(p, "vmin=")) {
+				n = slip_num(slip_word(p, "vmin="));
+				if (n < 0 || n > 255)
+					goto bad;
+				slip_vmin = n;
+			} else if (slip_word(p, "vtime=")) {
+				n = slip_num(slip_word(p, "vtime="));
+				if (n < 0 || n > 255)
+					goto bad;
+				slip_vtime = n;
+#if !NO_PCAP
+			} else if (slip_word(p, "pcap=")) {
+				slip_pcap = slip_word(p, "pcap=");
+				if (!*slip_pcap)
+					goto bad;
+#endif
+#if !NO_TRACE
+			} else if (slip_word(p, "trace=")) {
+				slip_trace = slip_word(p, "trace=");
+				if (!*slip_trace)
+					goto bad;
+#endif
+#if !NO_CSLIP
+			} else if (slip_word(p, "cslip=")) {
+				p = slip_word(p, "cslip=");
+				if (slip_word(p, "off") && !p[3])
+					cslip_on = CSLIP_OFF;
+				else if (slip_word(p, "on") && !p[2])
+					cslip_on = CSLIP_ON;
+				else if (slip_word(p, "auto") && !p[4])
+					cslip_on = CSLIP_AUTO;
+				else
+					goto bad;
+#endif
+			} else {
+				goto bad;
+			}
+		}
+		p = q;
+	}
+	return 1;
+
+bad:
+	fprintf(stderr, "slip: bad link option %s\n", p);
+	return 0;
+}
+
+/* take a -l link specification off the front of the command line, so the
+   caller can go on parsing it as if it weren't there. returns zero if it
+   was bad. */
+int slip_args(argcp, argvp)
+int *argcp;
+char ***argvp;
+{
+	char **argv = *argvp;
+
+	if (*argcp > 2 && argv[1][0] == '-' && argv[1][1] == 'l' &&
+			!argv[1][2]) {
+		if (!slip_config(argv[2]))
+			return 0;
+		argv[2] = argv[0];
+		*argvp = argv + 2;
+		*argcp -= 2;
+	}
+	return 1;
+}
+
+int slip_setup()
+{
+	if (!slip_given && getenv("BASS_LINK")) {
+		if (!slip_config(getenv("BASS_LINK")))
+			return 0;
+	}
+#if IS_POSIX
+	srand(time(NULL));
+#else
+#if VENIX
+	{
+		long ltime;
+		int itime;
+
+		/* you can't just srand(time(NULL)) */
+		time(&ltime);
+		itime = ltime;
+		srand(itime);
 	}
 #endif
 #endif
+	if (!link_open(slip_device))
+		return 0;
+	if ((link_cur->ln_flags & LINK_TTY) && !slip_tty()) {
+		link_close();
+		return 0;
+	}
+	if (slip_pcap && !cap_open(slip_pcap)) {
+		link_close();
+		return 0;
+	}
+	/* after the capture, so our signal handlers run first, then its */
+	if (slip_trace)
+		trace_start(slip_trace);
+#if IS_POSIX
+	/* we wait with poll() (see wheel.c), so reads and writes need never
+	   block, unless asked (or they aren't ours to change) */
+	if (!slip_block && !(link_cur->ln_flags & LINK_SHARED)) {
+		fcntl(link_rfd, F_SETFL, fcntl(link_rfd, F_GETFL) | O_NONBLOCK);
+		if (link_wfd != link_rfd)
+			fcntl(link_wfd, F_SETFL,
+				fcntl(link_wfd, F_GETFL) | O_NONBLOCK);
+	}
+#endif
+	slip_ihead = 0;
+	slip_itail = 0;
 	return 1;
 }
 
+/* step the line rate up from where it is now, sending the datagram in
+   payload at each rate and waiting a second or so for anything valid to
+   come back into reply. we stop at the first rate that gets no answer or a
+   garbled one, and go back to the last one that worked. this only makes
+   sense if the other end follows along, such as a server that autobauds.
+   returns the rate we settled on, or zero if nothing worked (or, without
+   poll() and termios, if we can't time out reads and so can't probe). */
+B32 slip_probe(payload, size, reply, rsize)
+SCH *payload; /* datagram that should draw a reply, like an echo request */
+int size; /* its length */
+SCH *reply; /* buffer for replies */
+int rsize; /* its length */
+{
+	B32 good = 0;
+#if IS_POSIX
+	B32 start;
+	struct timer t;
+	int i, j, k, got;
+
+	/* only a tty has a line rate */
+	if (!link_cur || !(link_cur->ln_flags & LINK_TTY))
+		return 0;
+
+	start = slip_baud;
+	t.tw_live = 0;
+	for(i=0; slip_rates[i]; i++) {
+		if (slip_rates[i] < start || slip_bcode(slip_rates[i]) < 0)
+			continue;
+		slip_baud = slip_rates[i];
+		if (!slip_tty())
+			break;
+		k = slip_resyncs;
+		got = 0;
+		for(j=0; j<3 && !got; j++) {
+			if (!slip_ship(payload, size))
+				break;
+			wheel_arm(&t, 1000L, 0, 0);
+			do {
+				got = slip_slurp(reply, rsize);
+			} while (!got && slip_fault == SLIP_TIMEOUT &&
+				t.tw_live);
+			wheel_drop(&t);
+			if (!got && slip_fault != SLIP_TIMEOUT)
+				break;
+		}
+		if (!got || slip_resyncs != k)
+			break;
+		good = slip_baud;
+	}
+	slip_baud = (good) ? good : start;
+	if (!slip_tty())
+		return 0;
+#endif
+	return good;
+}
+
 int slip_splat(payload, size)
 SCH *payload;
 int size;
@@ -129,12 +523,22 @@ int size;
 	return size;
 }
 
+/* checksums. slip_part() adds bytes into a running ones-complement sum
+   (RFC 1071) and returns it folded to 16 bits, but not inverted, so that a
+   checksum can be built up a piece at a time; start with zero, and make
+   every piece but the last an even length. slip_sum() does the whole thing
+   at once and inverts it. an odd byte at the end is added as the low-order
+   byte, as it always has been, so pad to an even length (as the clients
+   do) to get the RFC result. */
+
+/* the reference version, a 16-bit word at a time. this is what old
+   compilers get, and what the fast version had better agree with. */
 /* work around various compiler and signage bugs in old compilers */
-B16 slip_sum(payload, size)
+B32 slip_rsum(payload, size, sum)
 SCH *payload;
 int size;
+B32 sum;
 {
-	B32 sum = 0;
 	B32 j, k; /* used for intermediate values */
 	B32 m = (B32)65535;
 	int i = size;
@@ -150,6 +554,10 @@ int size;
 		j |= k;
 		sum += j;
 		i -= 2;
+
+		/* fold as we go, so a long buffer can't overflow */
+		if (sum > m)
+			sum = (sum & m) + ((sum >> 16) & m);
 	}
 
 	/* add last byte, if not an even multiple of two */
@@ -164,145 +572,906 @@ int size;
 	while (sum > m)
 		sum = (sum & m) + ((sum >> 16) & m);
 
-	sum = sum & m; /* paranoia */
-	return sum ^ m;
+	return sum & m; /* paranoia */
 }
 
-/* blocking write */
-int slip_ship(payload, size)
+/* with gcc or clang, SSE2 or AVX2 (x86_64 always has SSE2) let us work on
+   16 or 32 bytes at a time */
+#if __GNUC__
+#if __AVX2__
+#include <immintrin.h>
+#define SLIP_LANE	32
+#else
+#if __SSE2__
+#include <emmintrin.h>
+#define SLIP_LANE	16
+#endif
+#endif
+#endif
+
+#if __GNUC__ && !SLOW_SUM
+/* the fast version. ones-complement addition doesn't care about byte order
+   (RFC 1071 section 2), so we can add up whole native words as they lie,
+   with the carries piling up in the top of a 64-bit accumulator to be
+   folded back in once at the end, and swap the result around if we're
+   little-endian. with vectors, bytes go a lane at a time into 32-bit
+   lanes first. size must be even. */
+
+B32 slip_wide(payload, size)
 SCH *payload;
 int size;
 {
-	int i, j;
+	unsigned char *p = (unsigned char *)payload;
+	uint64_t sum = 0;
+	uint32_t w;
+	uint16_t h;
+#if SLIP_LANE
+	uint32_t lanes[8];
+	int i, n;
 
-	if (fd < 0)
-		return 0;
+	while (size >= SLIP_LANE) {
+		/* each lane takes at most two 16-bit words a go, so it can't
+		   overflow in under 32768 goes; we stop well short */
+		n = size / SLIP_LANE;
+		if (n > 4096)
+			n = 4096;
+		size -= n * SLIP_LANE;
+		{
+#if __AVX2__
+			__m256i v, z, acc;
 
-	write(fd, &slip_done, 1);
-	for(i=0;i<size;i++) {
-		j = *payload & 0xff;
-#if DEBUG
-		fprintf(stderr, " %02x ", j);
+			z = _mm256_setzero_si256();
+			acc = z;
+			for(i=0; i<n; i++) {
+				v = _mm256_loadu_si256((__m256i *)p);
+				acc = _mm256_add_epi32(acc,
+					_mm256_unpacklo_epi16(v, z));
+				acc = _mm256_add_epi32(acc,
+					_mm256_unpackhi_epi16(v, z));
+				p += SLIP_LANE;
+			}
+			_mm256_storeu_si256((__m256i *)lanes, acc);
+			n = 8;
+#else
+			__m128i v, z, acc;
+
+			z = _mm_setzero_si128();
+			acc = z;
+			for(i=0; i<n; i++) {
+				v = _mm_loadu_si128((__m128i *)p);
+				acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, z));
+				acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, z));
+				p += SLIP_LANE;
+			}
+			_mm_storeu_si128((__m128i *)lanes, acc);
+			n = 4;
+#endif
+		}
+		for(i=0; i<n; i++)
+			sum += lanes[i];
+	}
 #endif
+	/* the rest a 32-bit word at a time. memcpy() because p may not be
+	   aligned, and the compiler turns it into a plain load. */
+	while (size >= 4) {
+		memcpy(&w, p, 4);
+		sum += w;
+		p += 4;
+		size -= 4;
+	}
+	if (size >= 2) {
+		memcpy(&h, p, 2);
+		sum += h;
+	}
+
+	/* fold 64 to 16 bits */
+	sum = (sum & 0xffffffffUL) + (sum >> 32);
+	sum = (sum & 0xffffffffUL) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	sum = ((sum >> 8) & 0xff) | ((sum & 0xff) << 8);
+#endif
+	return (B32)sum;
+}
+#endif
+
+B32 slip_part(payload, size, sum)
+SCH *payload;
+int size;
+B32 sum;
+{
+#if __GNUC__ && !SLOW_SUM
+	B32 m = (B32)65535;
+
+	sum += slip_wide(payload, size & ~1);
+	if (size & 1)
+		sum += payload[size - 1] & 0xff;
+	while (sum > m)
+		sum = (sum & m) + ((sum >> 16) & m);
+	return sum;
+#else
+	return slip_rsum(payload, size, sum);
+#endif
+}
+
+B16 slip_sum(payload, size)
+SCH *payload;
+int size;
+{
+	return slip_part(payload, size, (B32)0) ^ (B32)65535;
+}
+
+/* change len bytes at field (an even number of them, an even distance
+   from where the checksum starts) to those at new, and fix up the 16-bit
+   checksum at check to match without adding everything up again. this is
+   eqn. 3 of RFC 1624, HC' = ~(~HC + ~m + m'), a word at a time. */
+int slip_mend(check, field, new, len)
+SCH *check;
+SCH *field;
+SCH *new;
+int len;
+{
+	B32 sum, j;
+	B32 m = (B32)65535;
+	int i;
+
+	sum = check[0] & 0xff;
+	sum <<= 8;
+	sum |= check[1] & 0xff;
+	sum ^= m;
+	for(i=0; i<len; i+=2) {
+		j = field[i] & 0xff;
+		j <<= 8;
+		j |= field[i+1] & 0xff;
+		sum += j ^ m;
+		j = new[i] & 0xff;
+		j <<= 8;
+		j |= new[i+1] & 0xff;
+		sum += j;
+		field[i] = new[i];
+		field[i+1] = new[i+1];
+		if (sum > m)
+			sum = (sum & m) + ((sum >> 16) & m);
+	}
+	while (sum > m)
+		sum = (sum & m) + ((sum >> 16) & m);
+	sum ^= m;
+	check[0] = (sum >> 8) & 0xff;
+	check[1] = sum & 0xff;
+	return 1;
+}
+
+/* how many bytes at the start of payload need no escaping, up to size. most
+   datagrams have long runs without END or ESC in them, which we can copy
+   in one go. with gcc or clang we look at a vector or a 64-bit word at a
+   time (a word has an END in it if it has a zero byte once XORed with all
+   ENDs, and likewise for ESC); define SLOW_SCAN to go a byte at a time. */
+int slip_clean(payload, size)
+SCH *payload;
+int size;
+{
 #if NO_ESCAPE
-		{
+	return size;
 #else
-		if (j == SLIP_END) {
-			write(fd, &slip_end, 2);
-		} else if (j == SLIP_ESC) {
-			write(fd, &slip_esc, 2);
-		} else {
+#if __GNUC__ && !SLOW_SCAN
+	unsigned char *p = (unsigned char *)payload;
+	uint64_t w, x, y;
+	uint64_t ones = 0x0101010101010101ULL;
+	uint64_t highs = 0x8080808080808080ULL;
+	int i;
+#if SLIP_LANE
+	unsigned int mask;
+#if __AVX2__
+	__m256i v, e, s;
+
+	e = _mm256_set1_epi8((char)SLIP_END);
+	s = _mm256_set1_epi8((char)SLIP_ESC);
+	for(i=0; i+SLIP_LANE<=size; i+=SLIP_LANE) {
+		v = _mm256_loadu_si256((__m256i *)(p + i));
+		mask = _mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(v, e), _mm256_cmpeq_epi8(v, s)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#else
+	__m128i v, e, s;
+
+	e = _mm_set1_epi8((char)SLIP_END);
+	s = _mm_set1_epi8((char)SLIP_ESC);
+	for(i=0; i+SLIP_LANE<=size; i+=SLIP_LANE) {
+		v = _mm_loadu_si128((__m128i *)(p + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(v, e), _mm_cmpeq_epi8(v, s)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
 #endif
-			write(fd, payload, 1);
-		}
-		payload++;
+#else
+	i = 0;
+#endif
+	for(; i+8<=size; i+=8) {
+		memcpy(&w, p + i, 8);
+		x = w ^ (ones * SLIP_END);
+		y = w ^ (ones * SLIP_ESC);
+		if (((x - ones) & ~x & highs) | ((y - ones) & ~y & highs))
+			break;
+	}
+	for(; i<size; i++) {
+		if (p[i] == SLIP_END || p[i] == SLIP_ESC)
+			break;
+	}
+	return i;
+#else
+	int i, j;
+
+	for(i=0; i<size; i++) {
+		j = payload[i] & 0xff;
+		if (j == SLIP_END || j == SLIP_ESC)
+			break;
 	}
-#if DEBUG
-	fprintf(stderr, "\n");
+	return i;
+#endif
+#endif
+}
+
+/* copy size bytes, which don't overlap */
+int slip_move(dst, src, size)
+SCH *dst;
+SCH *src;
+int size;
+{
+#if __GNUC__
+	memcpy(dst, src, size);
+#else
+	int i;
+
+	for(i=0; i<size; i++)
+		dst[i] = src[i];
 #endif
-	write(fd, &slip_done, 1);
 	return 1;
 }
 
-/* blocking read */
-int slip_slurp(payload, size)
+/* SLIP-encode bytes onto the end of the transmit buffer, flushing it
+   early if it fills. runs that need no escaping are copied straight
+   across. */
+int slip_encode(payload, size)
+SCH *payload;
+int size;
+{
+	int j, n;
+
+	while (size > 0) {
+		/* worst case, an escape pair plus the trailing END */
+		if (slip_olen > (SLIP_OBUF - 3)) {
+			if (!slip_sweep())
+				return 0;
+		}
+#if !NO_ESCAPE
+		j = *payload & 0xff;
+		if (j == SLIP_END || j == SLIP_ESC) {
+			slip_obuf[slip_olen++] = SLIP_ESC;
+			slip_obuf[slip_olen++] = (j == SLIP_END) ?
+				SLIP_NDE : SLIP_SCE;
+			payload++;
+			size--;
+			continue;
+		}
+#endif
+		/* otherwise, as much as will fit, leaving room for the END */
+		n = SLIP_OBUF - 1 - slip_olen;
+		if (n > size)
+			n = size;
+		n = slip_clean(payload, n);
+		slip_move(slip_obuf + slip_olen, payload, n);
+		slip_olen += n;
+		payload += n;
+		size -= n;
+	}
+	return 1;
+}
+
+/* what a datagram is, for the trace: the protocol, and the flags if it's
+   TCP */
+B32 slip_what(payload, size)
+SCH *payload;
+int size;
+{
+	int hlen;
+
+	hlen = (payload[0] & 0x0f) << 2;
+	if (payload[9] == 6 && size > hlen + 13)
+		return ((B32)6 << 8) | (payload[hlen + 13] & 0xff);
+	return (B32)(payload[9] & 0xff) << 8;
+}
+
+/* stage a datagram for transmission, encoding it for SLIP into the
+   transmit buffer. nothing is written until slip_sweep() is called, so
+   several datagrams (say, an ACK and a data segment) can be stacked up and
+   pushed in a single write. if the buffer fills, it is flushed early.
+   TCP headers are compressed here if CSLIP is on. */
+int slip_sack(payload, size)
 SCH *payload;
 int size;
 {
-	int i, j, newsize;
-	SCH c, d;
-	SCH *newp;
+	struct frag f;
+
+	f.fr_data = payload;
+	f.fr_size = size;
+	return slip_gather(&f, 1);
+}
+
+/* stage a datagram that is in n pieces, as if they were one, without
+   putting them together first. the first piece must have all of the
+   headers in it. */
+int slip_gather(frag, n)
+struct frag *frag;
+int n;
+{
+	int i, skip, size;
 
-	if (fd < 0)
+	if (!link_cur || n < 1)
 		return 0;
-	if (!slip_splat(payload, size))
+
+	size = 0;
+	for(i=0; i<n; i++)
+		size += frag[i].fr_size;
+	/* a frame already in the buffer ends with END, which also serves
+	   to start this one */
+	if (!slip_olen)
+		slip_obuf[slip_olen++] = SLIP_END;
+	cap_gather(frag, n);
+	TRACE(TR_TX, size, slip_what(frag[0].fr_data, size));
+	i = cslip_crunch(frag[0].fr_data, size, slip_vjhdr, &skip);
+	if (!slip_encode(slip_vjhdr, i) ||
+			!slip_encode(frag[0].fr_data + skip,
+				frag[0].fr_size - skip))
 		return 0;
+	for(i=1; i<n; i++) {
+		if (!slip_encode(frag[i].fr_data, frag[i].fr_size))
+			return 0;
+	}
+	slip_obuf[slip_olen++] = SLIP_END;
+	return 1;
+}
 
-	/* keep reading until we get an IPv4 byte and a valid DSCP/ECN byte */
-	/* this allows a modicum of proper framing, since it isn't guaranteed */
-	/* that we'd get a SLIP_END/c0 as a lead byte */
-	c = 0;
-	d = 0;
-	for(;;) {
-		i = read(fd, &d, 1);
-#if DEBUG
-		/* these may or may not be castoffs */
-		fprintf(stderr, ".%02x.", (unsigned int)(d & 0xff));
-#endif
-		if (c == 0x45) {
-			/* XXX: others? */
-			if (d == 0x00 || d == 0x08 || d == 0x10)
-				break; /* valid */
-		}
-		c = d;
-	}
-#if DEBUG
-	fprintf(stderr, "\n");
-#endif
-	payload[0] = 0x45;
-	payload[1] = d;
-	newp = payload + 1;
-	/* keep reading until we get a SLIP END byte or run out of memory */
-	for(newsize=1; newsize<size; newsize++) {
-		i = read(fd, ++newp, 1);
-		j = (*newp) & 0xff;
-		if (j == SLIP_END) break; /* c0 */
-
-		/* unescape escaped sequences */
-		if (j == SLIP_ESC) {
-			i = read(fd, &c, 1);
-			j = c & 0xff;
-			if (j == SLIP_SCE) {
-				*newp = SLIP_ESC;
-				continue;
-			} else if (j == SLIP_NDE) {
-				*newp = SLIP_END;
+/* write everything staged by slip_sack(), waiting as long as it takes */
+int slip_sweep()
+{
+	int i, j;
+
+	if (!link_cur)
+		return 0;
+
+	for(i=0; i<slip_olen; i+=j) {
+		j = link_write(slip_obuf + i, slip_olen - i);
+		if (j > 0)
+			continue;
+#if IS_POSIX
+		/* the line is backed up, so wait for it, running any timers
+		   in the meantime */
+		if (j < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR)) {
+			j = 0;
+			if (wheel_wait(link_wfd, WHEEL_OUT) > 0)
 				continue;
-			} else {
-				/* likely not SLIP, abort */
-#if DEBUG
-				fprintf(stderr, "slip: nonsense ESC\n");
+		}
 #endif
+		slip_fault = SLIP_FAILED;
+		slip_olen = 0;
+		return 0;
+	}
+	slip_olen = 0;
+	return 1;
+}
+
+/* write a single datagram (and anything already staged) */
+int slip_ship(payload, size)
+SCH *payload;
+int size;
+{
+	if (!slip_sack(payload, size))
+		return 0;
+	return slip_sweep();
+}
+
+/* get the next byte off the line, refilling the receive buffer with a
+   single read if it has run dry. if we have to wait for the line and a
+   timer sounds the alarm first, we return zero with slip_fault set to
+   SLIP_TIMEOUT. */
+int slip_byte(c)
+SCH *c;
+{
+	int i;
+
+	if (slip_ihead == slip_itail) {
+		slip_ihead = 0;
+		slip_itail = 0;
+		for(;;) {
+			i = wheel_wait(link_rfd, WHEEL_IN);
+			if (!i) {
+				slip_fault = SLIP_TIMEOUT;
 				return 0;
 			}
-		}			
-	}
-	newsize++;
-#if DEBUG
-	for (i=0;i<newsize;i++) { fprintf(stderr, "-%02x ",
-		(unsigned int)(payload[i] & 0xff)); }
-	fprintf(stderr, "\n");
-#endif
-	if (newsize >= size) { /* buffer full, likely not SLIP */
-#if DEBUG
-		fprintf(stderr, "slip: buffer oversize %d > %d\n", newsize, size);
+			if (i > 0) {
+				i = link_read(slip_ibuf, SLIP_IBUF);
+				if (i > 0)
+					break;
+#if IS_POSIX
+				if (i < 0 && (errno == EAGAIN ||
+						errno == EWOULDBLOCK ||
+						errno == EINTR))
+					continue;
 #endif
+			}
+			slip_fault = SLIP_FAILED;
+			return 0;
+		}
+		slip_itail = i;
+	}
+	*c = slip_ibuf[slip_ihead++];
+	return 1;
+}
+
+/* add up size bytes of a datagram starting at offset from, as slip_slurp()
+   does: in big-endian words counted from the start of the datagram, so a
+   byte at an odd offset is the low half of one, with an odd byte at the
+   end padded with zero. returns the folded partial sum. */
+B32 slip_add(payload, from, size)
+SCH *payload;
+int from;
+int size;
+{
+	B32 sum;
+	B32 m = (B32)65535;
+
+	sum = 0;
+	if (size && (from & 1)) {
+		sum = payload[from++] & 0xff;
+		size--;
+	}
+	sum = slip_part(payload + from, size & ~1, sum);
+	if (size & 1) {
+		sum += ((B32)(payload[from + size - 1] & 0xff)) << 8;
+		if (sum > m)
+			sum = (sum & m) + ((sum >> 16) & m);
+	}
+	return sum;
+}
+
+/* add up n pieces of a datagram as if they were one (see slip_gather()),
+   like slip_add(). a piece that starts at an odd offset has its bytes the
+   other way around in every word, so its sum is just swapped (RFC 1071
+   section 2). */
+B32 slip_frag(frag, n)
+struct frag *frag;
+int n;
+{
+	int i, odd;
+	B32 sum, v;
+	B32 m = (B32)65535;
+
+	sum = 0;
+	odd = 0;
+	for(i=0; i<n; i++) {
+		v = slip_add(frag[i].fr_data, 0, frag[i].fr_size);
+		if (odd)
+			v = ((v >> 8) & 0xff) | ((v & 0xff) << 8);
+		sum += v;
+		if (sum > m)
+			sum = (sum & m) + ((sum >> 16) & m);
+		odd ^= frag[i].fr_size & 1;
+	}
+	return sum;
+}
+
+/* work out slip_hsum and slip_psum the slow way, for a datagram that
+   wasn't what came over the line (such as one whose header CSLIP rebuilt) */
+int slip_tally(payload, size)
+SCH *payload;
+int size;
+{
+	int hlen;
+
+	hlen = (payload[0] & 0x0f) << 2;
+	if (hlen > size)
+		hlen = size;
+	slip_hsum = slip_part(payload, hlen, (B32)0);
+	/* pad to an even length; there's always room */
+	payload[size] = 0;
+	slip_psum = slip_part(payload + hlen, (size - hlen + 1) & ~1,
+		(B32)0);
+	return 1;
+}
+
+/* the partial sum of the TCP or UDP pseudo-header for a datagram, made
+   up from its IP header without touching it */
+B32 slip_phdr(payload, size)
+SCH *payload;
+int size;
+{
+	B32 sum;
+	B32 m = (B32)65535;
+
+	/* addresses, then zero and protocol, then the length of what
+	   follows the IP header */
+	sum = slip_part(payload + 12, 8, (B32)(payload[9] & 0xff));
+	sum += size - ((payload[0] & 0x0f) << 2);
+	while (sum > m)
+		sum = (sum & m) + ((sum >> 16) & m);
+	return sum;
+}
+
+/* check the TCP, UDP or ICMP checksum of the datagram slip_slurp() just
+   returned (or another one, after a slip_tally() on it), leaving it as it
+   is. returns non-zero if it's good. */
+int slip_valid(payload, size)
+SCH *payload;
+int size;
+{
+	B32 sum;
+	B32 m = (B32)65535;
+	int hlen;
+
+	hlen = (payload[0] & 0x0f) << 2;
+	switch(payload[9] & 0xff) {
+		case 1: /* ICMP has no pseudo-header */
+			return (slip_psum == m);
+		case 17:
+			/* a UDP checksum of zero means there isn't one */
+			if (size >= hlen + 8 && !payload[hlen + 6] &&
+					!payload[hlen + 7])
+				return 1;
+			break;
+	}
+	sum = slip_phdr(payload, size) + slip_psum;
+	while (sum > m)
+		sum = (sum & m) + ((sum >> 16) & m);
+	return (sum == m); /* RFC 1071 */
+}
+
+/* check a received frame is a whole, sane IPv4 datagram */
+int slip_sound(payload, size)
+SCH *payload;
+int size;
+{
+	int i, hlen;
+
+	/* version 4, and a header length we can actually check */
+	hlen = (payload[0] & 0x0f) << 2;
+	if ((payload[0] & 0xf0) != 0x40 || hlen < 20 || size < hlen) {
+		TRACE(TR_NOTIP, size, payload[0] & 0xff);
 		return 0;
 	}
 
 	/* validate the length and IP header checksum */
 	i = payload[3] & 0xff;
 	i += ((payload[2] & 0xff) << 8);
-	if (i != newsize) { /* length is wrong */
-#if DEBUG
-		fprintf(stderr, "slip: length mismatch %d != %d\n", i, newsize);
-#endif
+	if (i != size) { /* length is wrong */
+		TRACE(TR_BADLEN, i, size);
 		return 0;
 	}
-	i = slip_sum(payload, 20); /* including checksum */
-	if (i) { /* see RFC 1071 */
-#if DEBUG
-		fprintf(stderr, "slip: corrupt IP header\n");
-#endif
+	/* including checksum and options, summed already by slip_slurp() */
+	if (slip_hsum != (B32)65535) { /* see RFC 1071 */
+		TRACE(TR_BADHDR, size, 0);
 		return 0; 
 	}
-	/* caller is responsible for any checksums on the remainder */
-	return newsize;
+	return 1;
+}
+
+/* send the data of in-order segments to sk from now on, or stop if it's
+   NULL. only do this while waiting for its port, since a datagram whose
+   data went to the sink is only half there if someone else gets it. */
+int slip_divert(sk)
+struct sink *sk;
+{
+	slip_sink = sk;
+	if (sk)
+		sk->sk_got = 0;
+	return 1;
+}
+
+/* given the first size bytes of a frame, see if the rest is data for the
+   sink: an uncompressed TCP segment from its peer to its port, at or after the sequence
+   number it wants, which fits and doesn't cover any of what the sink is
+   holding (a bad one would spoil it). returns where the data starts if so,
+   or more than size if we need that much of the frame to tell, or zero if
+   not. */
+int slip_fork(payload, size)
+SCH *payload;
+int size;
+{
+	int i, hlen, doff, len;
+	B32 port, off, want;
+	struct sink *sk = slip_sink;
+
+	/* compressed headers are rebuilt at the end, so they don't count */
+	hlen = (payload[0] & 0x0f) << 2;
+	if ((payload[0] & 0xf0) != 0x40 || hlen < 20 || payload[9] != 6)
+		return 0;
+	if (size < hlen + 20)
+		return hlen + 20;
+	doff = (payload[hlen + 12] >> 2) & 0x3c;
+	if (doff < 20)
+		return 0;
+	if (size < hlen + doff)
+		return hlen + doff;
+
+	/* only from them, to us, and not a SYN or RST, which aren't for
+	   the stream even when they have data */
+	for(i=0; i<4; i++) {
+		if (payload[12 + i] != sk->sk_peer[i])
+			return 0;
+	}
+	port = payload[hlen] & 0xff;
+	port = (port << 8) | (payload[hlen + 1] & 0xff);
+	if (port != sk->sk_rport)
+		return 0;
+	port = payload[hlen + 2] & 0xff;
+	port = (port << 8) | (payload[hlen + 3] & 0xff);
+	if (port != sk->sk_port)
+		return 0;
+	if (payload[hlen + 13] & (2 | 4))
+		return 0;
+	/* how far past what it wants this starts */
+	off = 0;
+	want = 0;
+	for(i=0; i<4; i++) {
+		off = (off << 8) | (payload[hlen + 4 + i] & 0xff);
+		want = (want << 8) | (sk->sk_seqno[i] & 0xff);
+	}
+	off -= want;
+	if (off < 0 || off >= sk->sk_room - sk->sk_used)
+		return 0;
+	len = ((payload[2] & 0xff) << 8) + (payload[3] & 0xff) - hlen - doff;
+	if (len < 1 || len > sk->sk_room - sk->sk_used - (int)off)
+		return 0;
+	for(i=0; i<sk->sk_runs; i++) {
+		if (off < sk->sk_to[i] && off + len > sk->sk_from[i])
+			return 0;
+	}
+	sk->sk_off = off;
+	return hlen + doff;
+}
+
+/* blocking read. this is the receive side of RFC 1055: bytes accumulate
+   until an END, and an END with nothing in front of it is ignored, so a
+   peer that leads its frames with END costs us nothing. a frame that
+   doesn't decode (a bad escape, or too big for the buffer) is thrown away
+   up to the next END, as is one that doesn't validate as an IPv4 datagram,
+   and either way we count a resync and keep waiting for a good one. */
+int slip_slurp(payload, size)
+SCH *payload;
+int size;
+{
+	int j, k, newsize, state, late, hlen, split, stop, room;
+	B32 v, hsum, psum;
+	B32 m = (B32)65535;
+	SCH c, *at, *to;
+	struct frag f[2];
+
+	slip_fault = SLIP_FAILED;
+	if (!link_cur)
+		return 0;
+
+	newsize = 0;
+	state = SLIP_RX_DATA;
+	late = 0;
+	hlen = 0;
+	hsum = 0;
+	psum = 0;
+	/* once the frame is split bytes long, the rest goes to the sink at
+	   at, which has room for that much. until then, we look at it again
+	   when it's stop bytes long. */
+	split = 0;
+	stop = (slip_sink) ? 20 : 0;
+	room = 0;
+	at = NULL;
+	if (slip_sink)
+		slip_sink->sk_got = 0;
+	for(;;) {
+		if (stop && newsize == stop) {
+			stop = slip_fork(payload, newsize);
+			if (stop == newsize) {
+				split = newsize;
+				stop = 0;
+				at = slip_sink->sk_data + slip_sink->sk_used +
+					slip_sink->sk_off;
+				room = slip_sink->sk_room - slip_sink->sk_used -
+					slip_sink->sk_off;
+			}
+		}
+
+		/* take whatever is waiting that needs no unescaping in one
+		   go, adding it up as we do below a byte at a time. anything
+		   else (END, ESC, what comes after ESC, or a frame that's
+		   grown too big) is left for the slow path. */
+		if (state != SLIP_RX_ESC && slip_ihead < slip_itail &&
+				(k = slip_ibuf[slip_ihead] & 0xff) != SLIP_END &&
+				k != SLIP_ESC) {
+			k = slip_itail - slip_ihead;
+			if (state == SLIP_RX_DATA) {
+				j = (split) ? split + room : size - 1;
+				if (k > j - newsize)
+					k = j - newsize;
+				/* stop where slip_fork() wants another look */
+				if (stop > newsize && k > stop - newsize)
+					k = stop - newsize;
+			}
+			k = slip_clean(slip_ibuf + slip_ihead, k);
+			if (k && state == SLIP_RX_DATA) {
+				/* (split is even, so the byte before is ours) */
+				to = (split) ? at + newsize - split :
+					payload + newsize;
+				slip_move(to, slip_ibuf + slip_ihead, k);
+				if (!newsize)
+					hlen = (payload[0] & 0x0f) << 2;
+				j = 0;
+				if (newsize < hlen) {
+					j = (k < hlen - newsize) ? k :
+						hlen - newsize;
+					hsum += slip_add(payload, newsize, j);
+				}
+				psum += slip_add(to - (newsize & 1),
+					(newsize & 1) + j, k - j);
+				hsum = (hsum & m) + ((hsum >> 16) & m);
+				psum = (psum & m) + ((psum >> 16) & m);
+				newsize += k;
+			}
+			slip_ihead += k;
+			if (k)
+				continue;
+		}
+
+		if (!slip_byte(&c)) {
+			if (slip_fault != SLIP_TIMEOUT)
+				return 0;
+			/* a timer went off. if we're partway through a frame,
+			   give the rest of it time to arrive, and pass the
+			   alarm on after. */
+			if (newsize && state != SLIP_RX_TOSS &&
+					(!late || slip_grace.tw_live)) {
+				if (!late) {
+					late = 1;
+					wheel_arm(&slip_grace, ((B32)size *
+						20000L / slip_baud) + 500L,
+						0, 0);
+				}
+				continue;
+			}
+			/* out of time. we lose what we had of the frame. */
+			if (newsize && state != SLIP_RX_TOSS) {
+				TRACE(TR_LATE, newsize, 0);
+				slip_resyncs++;
+				cslip_error();
+			}
+			return 0;
+		}
+		j = c & 0xff;
+
+		if (j == SLIP_END) {
+			if (state == SLIP_RX_DATA && newsize) {
+				/* rebuild the datagram if the header was
+				   compressed */
+				j = payload[0] & 0xff;
+				if ((j & 0x80) || (j & 0xf0) == 0x70) {
+					newsize = cslip_uncrunch(payload,
+						newsize, size - 1);
+					/* so what we added up isn't it */
+					if (newsize)
+						slip_tally(payload, newsize);
+				} else {
+					while (hsum > m)
+						hsum = (hsum & m) +
+							((hsum >> 16) & m);
+					while (psum > m)
+						psum = (psum & m) +
+							((psum >> 16) & m);
+					slip_hsum = hsum;
+					slip_psum = psum;
+				}
+				/* caller is responsible for any checksums on
+				   the remainder, but slip_psum has the sum */
+				if (newsize && slip_sound(payload, newsize)) {
+					if (split) {
+						f[0].fr_data = payload;
+						f[0].fr_size = split;
+						f[1].fr_data = at;
+						f[1].fr_size = newsize - split;
+						cap_gather(f, 2);
+						slip_sink->sk_got = newsize - split;
+					} else
+						cap_write(payload, newsize);
+					TRACE(TR_RX, newsize,
+						slip_what(payload, newsize));
+					if (late) {
+						wheel_drop(&slip_grace);
+						wheel_alarm = 1;
+					}
+					return newsize;
+				}
+				slip_resyncs++;
+				cslip_error();
+			} else if (state == SLIP_RX_ESC) {
+				slip_resyncs++;
+				cslip_error();
+			}
+			/* either way, this END starts a fresh frame */
+			newsize = 0;
+			state = SLIP_RX_DATA;
+			hlen = 0;
+			hsum = 0;
+			psum = 0;
+			split = 0;
+			stop = (slip_sink) ? 20 : 0;
+			continue;
+		}
+		if (state == SLIP_RX_TOSS)
+			continue;
+
+		if (state == SLIP_RX_ESC) {
+			/* unescape escaped sequences */
+			state = SLIP_RX_DATA;
+			if (j == SLIP_NDE) {
+				c = SLIP_END;
+			} else if (j == SLIP_SCE) {
+				c = SLIP_ESC;
+			} else {
+				/* likely not SLIP, or we came in partway */
+				TRACE(TR_BADESC, j, newsize);
+				state = SLIP_RX_TOSS;
+				slip_resyncs++;
+				cslip_error();
+				continue;
+			}
+		} else if (j == SLIP_ESC) {
+			state = SLIP_RX_ESC;
+			continue;
+		}
+
+		/* always leave a byte spare so callers can pad to an even
+		   length for checksumming */
+		if (newsize >= ((split) ? split + room : size - 1)) {
+			TRACE(TR_OVER, size, 0);
+			state = SLIP_RX_TOSS;
+			slip_resyncs++;
+			cslip_error();
+			continue;
+		}
+		/* add it up as we go, as big-endian 16-bit words (an odd
+		   byte at the end is padded with zero, as the RFC says): the
+		   IP header in one sum, and the rest in another. we don't
+		   know how long the header is until we have its first byte. */
+		v = c & 0xff;
+		if (!newsize)
+			hlen = (v & 0x0f) << 2;
+		if (!(newsize & 1))
+			v <<= 8;
+		if (newsize < hlen)
+			hsum += v;
+		else
+			psum += v;
+		if (split)
+			at[newsize - split] = c;
+		else
+			payload[newsize] = c;
+		newsize++;
+		/* fold now and then, lest it overflow on a big buffer */
+		if (!(newsize & 0x3fff)) {
+			hsum = (hsum & m) + ((hsum >> 16) & m);
+			psum = (psum & m) + ((psum >> 16) & m);
+		}
+	}
 }
 
 int slip_stop()
 {
-	close(fd); /* ignore return code */
-	fd = -1;
+	link_close(); /* ignore return code */
+	cap_close();
+	trace_dump();
+	slip_ihead = 0;
+	slip_itail = 0;
+	slip_olen = 0;
 	return 0;
 }
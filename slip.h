@@ -1,13 +1,86 @@
+/* one piece of a datagram that is in more than one piece. see
+   slip_gather(). */
+struct frag {
+	SCH *fr_data;
+	int fr_size;
+};
+
+/* how many runs of out-of-order data a sink holds at once (see recvq.c) */
+#ifndef SINK_RUNS
+#define SINK_RUNS	4
+#endif
+
+/* somewhere for slip_slurp() to put the data of a TCP segment, instead of
+   after its headers. see slip_divert(). */
+struct sink {
+	SCH *sk_data;	/* the buffer */
+	int sk_room;	/* how big it is */
+	int sk_used;	/* how much is taken; new data goes after that */
+	int sk_got;	/* how much the last datagram put there, if any */
+	int sk_off;	/* and how far past sk_used it went */
+	B32 sk_port;	/* our TCP port */
+	SCH *sk_peer;	/* their 32 bit IPv4 address */
+	B32 sk_rport;	/* and their TCP port */
+	SCH *sk_seqno;	/* 32 bit sequence number the data must start at */
+	int sk_runs;	/* runs held past sk_used, waiting for what's before */
+	int sk_from[SINK_RUNS];	/* where each starts, past sk_used */
+	int sk_to[SINK_RUNS];	/* and where it ends */
+	int sk_fin;	/* where their FIN is, past sk_used, or -1 */
+};
+
 int slip_setup();
 #if __GNUC__
+int slip_config(char *spec);
+int slip_args(int *argcp, char ***argvp);
+B32 slip_probe(SCH *payload, int size, SCH *reply, int rsize);
 B16 slip_sum(SCH *payload, int size);
+B32 slip_part(SCH *payload, int size, B32 sum);
+B32 slip_rsum(SCH *payload, int size, B32 sum);
+int slip_mend(SCH *check, SCH *field, SCH *new, int len);
+int slip_tally(SCH *payload, int size);
+B32 slip_phdr(SCH *payload, int size);
+int slip_valid(SCH *payload, int size);
 int slip_ship(SCH *payload, int size);
+int slip_sack(SCH *payload, int size);
+int slip_gather(struct frag *frag, int n);
+B32 slip_frag(struct frag *frag, int n);
 int slip_splat(SCH *payload, int size);
+int slip_move(SCH *dst, SCH *src, int size);
+int slip_divert(struct sink *sk);
 int slip_slurp(SCH *payload, int size);
 #else
+int slip_config();
+int slip_args();
+B32 slip_probe();
 B16 slip_sum();
+B32 slip_part();
+B32 slip_rsum();
+int slip_mend();
+int slip_tally();
+B32 slip_phdr();
+int slip_valid();
 int slip_ship();
+int slip_sack();
+int slip_gather();
+B32 slip_frag();
 int slip_splat();
+int slip_move();
+int slip_divert();
 int slip_slurp();
 #endif
+int slip_sweep();
 int slip_stop();
+
+extern int slip_resyncs;
+extern B32 slip_baud;
+extern int slip_fault;
+/* partial checksums (see slip_part()) of the IP header and of everything
+   after it, padded to an even length, for the datagram slip_slurp() just
+   returned */
+extern B32 slip_hsum;
+extern B32 slip_psum;
+extern struct sink *slip_sink;
+
+/* slip_fault values, for when slip_slurp() et al. return zero */
+#define SLIP_TIMEOUT	1	/* a timer went off first */
+#define SLIP_FAILED	2	/* the link failed */
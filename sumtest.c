@@ -0,0 +1,369 @@
+/* Checksum and SLIP tests for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * slip_part() has fast versions for gcc and clang that add up whole words,
+ * or SSE2/AVX2 vectors, at a time. This checks them against the portable
+ * slip_rsum() on random, all-ones and all-zero buffers up to PACKET_SIZE
+ * bytes at odd offsets and lengths, and then times both on a few sizes of
+ * buffer.
+ *
+ * slip_clean() likewise finds runs that need no escaping a word or vector
+ * at a time, for slip_encode() and slip_slurp() to copy in one go. To check
+ * them, ST_FRAMES datagrams of every length, random, all END, all ESC, a
+ * mix of those and plain text, are sent over a link to a file and read back
+ * with slip_slurp(), which must give back every one as it was, with sums
+ * that match. Then sending to /dev/null and reading back from the file are
+ * timed, on full-sized datagrams of text and of nothing but END.
+ *
+ * It exits with 1 on the first thing that's wrong. "make check" builds and
+ * runs it as is, with SLOW_SUM and SLOW_SCAN, and with line buffers so
+ * small that every frame straddles them.
+ */
+
+#include "compat.h"
+#include "slip.h"
+#include "wheel.h"
+#include "pbuf.h"
+#include "tcp.h"
+
+/* how many buffers to compare, and how long to time each thing for, in
+   ms */
+#define ST_TRIES	200000L
+#define ST_MS		500
+
+/* how many datagrams go through the file, and where it is */
+#define ST_FRAMES	3000
+#define ST_FILE		"sumtest.tmp"
+/* how many go through it at a time when timing */
+#define ST_BENCH	1000
+
+/* RFC 1055 (slip.c has its own) */
+#define ST_END		0xc0
+#define ST_ESC		0xdb
+#define ST_NDE		0xdc
+#define ST_SCE		0xdd
+
+/* room for a full-sized datagram at any offset up to 8 */
+SCH st_buf[PACKET_SIZE + 16];
+/* and one to read them back into, with a byte for padding */
+SCH st_got[PACKET_SIZE + 1];
+
+/* a random 16-bit number, however small RAND_MAX is */
+B32 st_rand16()
+{
+	return ((B32)(rand() & 0xff) << 8) | (B32)(rand() & 0xff);
+}
+
+/* fill size bytes: random, all ones or all zeroes */
+int st_fill(p, size, kind)
+SCH *p;
+int size;
+int kind;
+{
+	int i;
+
+	for(i=0; i<size; i++)
+		p[i] = (kind == 0) ? rand() : (kind == 1) ? 0xff : 0;
+	return 1;
+}
+
+/* compare slip_part() with slip_rsum() on ST_TRIES buffers */
+int st_sums()
+{
+	B32 i, sum, want, got;
+	int off, size;
+
+	for(i=0; i<ST_TRIES; i++) {
+		off = rand() & 7;
+		size = rand() % (PACKET_SIZE + 1);
+		st_fill(st_buf + off, size, (int)(i % 3));
+		sum = st_rand16();
+		want = slip_rsum(st_buf + off, size, sum);
+		got = slip_part(st_buf + off, size, sum);
+		if (got != want) {
+			fprintf(stderr, "sum: %d bytes at offset %d from ",
+				size, off);
+			fprintf(stderr, "%04lx: got %04lx, want %04lx\n",
+				(long)sum, (long)got, (long)want);
+			return 0;
+		}
+	}
+	printf("checksums: %ld buffers agree with slip_rsum()\n",
+		(long)ST_TRIES);
+	return 1;
+}
+
+/* print how fast kb kilobytes went in ms, in MB/s */
+int st_rate(what, kb, ms)
+char *what;
+B32 kb;
+B32 ms;
+{
+	if (ms < 1)
+		ms = 1;
+	printf("  %-28s %6ld MB/s\n", what, (long)(kb / ms));
+	return 1;
+}
+
+/* time slip_rsum() or slip_part() on size bytes */
+int st_time(what, size, fast)
+char *what;
+int size;
+int fast;
+{
+	B32 start, ms, kb, sum;
+	int i;
+
+	st_fill(st_buf, size, 0);
+	sum = 0;
+	kb = 0;
+	start = wheel_now();
+	do {
+		for(i=0; i<1000; i++) {
+			sum = (fast) ? slip_part(st_buf, size, sum) :
+				slip_rsum(st_buf, size, sum);
+		}
+		kb += size;
+		ms = wheel_now() - start;
+	} while (ms < ST_MS);
+	/* (use the sum, so it can't be left out) */
+	if (sum < 0)
+		printf("?\n");
+	return st_rate(what, kb, ms);
+}
+
+/* make a datagram of size bytes, with a good IP header hlen bytes long:
+   random (kind 0), all END (1), all ESC (2), a mix of END, ESC and what
+   comes after ESC (3), or text that needs no escaping (4) */
+int st_frame(p, size, hlen, kind)
+SCH *p;
+int size;
+int hlen;
+int kind;
+{
+	static int mix[] = { ST_END, ST_ESC, ST_NDE, ST_SCE, 'a' };
+	int i;
+	B32 sum;
+
+	for(i=0; i<size; i++) {
+		p[i] = (kind == 0) ? rand() : (kind == 1) ? ST_END :
+			(kind == 2) ? ST_ESC : (kind == 3) ? mix[rand() % 5] :
+			'a' + rand() % 26;
+	}
+	p[0] = 0x40 | (hlen >> 2);
+	p[2] = (size >> 8) & 0xff;
+	p[3] = size & 0xff;
+	p[9] = 17;
+	p[10] = 0;
+	p[11] = 0;
+	sum = slip_rsum(p, hlen, (B32)0) ^ (B32)65535;
+	p[10] = (sum >> 8) & 0xff;
+	p[11] = sum & 0xff;
+	return 1;
+}
+
+/* make datagram n of the round trip, the same each time, in two pieces
+   (the first with all of the headers in it). returns its size. */
+int st_make(n, f)
+int n;
+struct frag *f;
+{
+	int size, hlen;
+
+	srand(n + 1);
+	hlen = 20 + 4 * (rand() % 11);
+	size = hlen + rand() % (PACKET_SIZE - hlen);
+	st_frame(st_buf, size, hlen, n % 5);
+	f[0].fr_data = st_buf;
+	f[0].fr_size = hlen + rand() % (size - hlen + 1);
+	f[1].fr_data = st_buf + f[0].fr_size;
+	f[1].fr_size = size - f[0].fr_size;
+	return size;
+}
+
+/* open the link on ST_FILE, emptying it first if fresh */
+int st_open(fresh)
+int fresh;
+{
+	FILE *f;
+
+	if (fresh) {
+		if (!(f = fopen(ST_FILE, "w"))) {
+			perror(ST_FILE);
+			return 0;
+		}
+		fclose(f);
+	}
+	return link_open(ST_FILE);
+}
+
+/* send ST_FRAMES datagrams through the file and check what comes back */
+int st_trip()
+{
+	struct frag f[2];
+	int i, j, size, hlen;
+
+	if (!st_open(1))
+		return 0;
+	for(i=0; i<ST_FRAMES; i++) {
+		st_make(i, f);
+		if (!slip_gather(f, 2)) {
+			fprintf(stderr, "trip: frame %d didn't go\n", i);
+			return 0;
+		}
+	}
+	if (!slip_sweep() || !st_open(0))
+		return 0;
+	for(i=0; i<ST_FRAMES; i++) {
+		size = st_make(i, f);
+		hlen = (st_buf[0] & 0x0f) << 2;
+		j = slip_slurp(st_got, PACKET_SIZE);
+		if (j != size) {
+			fprintf(stderr, "trip: frame %d is %d bytes, not %d\n",
+				i, j, size);
+			return 0;
+		}
+		for(j=0; j<size && st_got[j] == st_buf[j]; j++)
+			;
+		if (j < size) {
+			fprintf(stderr, "trip: frame %d differs at %d\n",
+				i, j);
+			return 0;
+		}
+		st_got[size] = 0;
+		if (slip_hsum != slip_rsum(st_got, hlen, (B32)0) ||
+				slip_psum != slip_rsum(st_got + hlen,
+					(size - hlen + 1) & ~1, (B32)0)) {
+			fprintf(stderr, "trip: frame %d sums are wrong\n", i);
+			return 0;
+		}
+	}
+	link_close();
+	if (slip_resyncs) {
+		fprintf(stderr, "trip: %d resyncs\n", slip_resyncs);
+		return 0;
+	}
+	printf("round trip: %d frames come back as they went\n", ST_FRAMES);
+	return 1;
+}
+
+/* time sending (to /dev/null) and receiving (from ST_FILE) full-sized
+   datagrams of a kind */
+int st_line(what, kind)
+char *what;
+int kind;
+{
+	B32 start, ms, kb;
+	char line[40];
+	int i, size;
+
+	size = PACKET_SIZE - 1;
+	st_frame(st_buf, size, 20, kind);
+
+	if (!link_open("/dev/null"))
+		return 0;
+	kb = 0;
+	start = wheel_now();
+	do {
+		for(i=0; i<ST_BENCH; i++) {
+			if (!slip_sack(st_buf, size))
+				return 0;
+		}
+		kb += (B32)size * ST_BENCH / 1000;
+		ms = wheel_now() - start;
+	} while (ms < ST_MS);
+	if (!slip_sweep())
+		return 0;
+	sprintf(line, "send %s", what);
+	st_rate(line, kb, ms);
+
+	/* the same again into the file, to be read back */
+	if (!st_open(1))
+		return 0;
+	for(i=0; i<ST_BENCH; i++) {
+		if (!slip_sack(st_buf, size))
+			return 0;
+	}
+	if (!slip_sweep())
+		return 0;
+	kb = 0;
+	start = wheel_now();
+	do {
+		if (!st_open(0))
+			return 0;
+		for(i=0; i<ST_BENCH; i++) {
+			if (slip_slurp(st_got, PACKET_SIZE) != size) {
+				fprintf(stderr, "line: frame %d is wrong\n", i);
+				return 0;
+			}
+		}
+		kb += (B32)size * ST_BENCH / 1000;
+		ms = wheel_now() - start;
+	} while (ms < ST_MS);
+	link_close();
+	sprintf(line, "receive %s", what);
+	return st_rate(line, kb, ms);
+}
+
+main(argc, argv)
+int argc;
+char **argv;
+{
+	static int sizes[] = { 40, 576, PACKET_SIZE };
+	char what[40];
+	int i;
+
+	srand(1);
+	printf("checksum: %s\n",
+#if __GNUC__ && !SLOW_SUM
+#if __AVX2__
+		"AVX2"
+#else
+#if __SSE2__
+		"SSE2"
+#else
+		"words"
+#endif
+#endif
+#else
+		"portable"
+#endif
+	);
+	printf("SLIP scan: %s\n",
+#if __GNUC__ && !SLOW_SCAN
+#if __AVX2__
+		"AVX2"
+#else
+#if __SSE2__
+		"SSE2"
+#else
+		"words"
+#endif
+#endif
+#else
+		"bytes"
+#endif
+	);
+	if (!st_sums())
+		exit(1);
+	for(i=0; i<3; i++) {
+		sprintf(what, "slip_rsum, %d bytes", sizes[i]);
+		st_time(what, sizes[i], 0);
+		sprintf(what, "slip_part, %d bytes", sizes[i]);
+		st_time(what, sizes[i], 1);
+	}
+	i = st_trip();
+	if (i) {
+		sprintf(what, "text, %d bytes", PACKET_SIZE - 1);
+		i = st_line(what, 4);
+	}
+	if (i) {
+		sprintf(what, "all END, %d bytes", PACKET_SIZE - 1);
+		i = st_line(what, 1);
+	}
+	link_close();
+	unlink(ST_FILE);
+	exit(!i);
+}
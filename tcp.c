@@ -9,17 +9,60 @@
  * tcp_total32() is a very stupid, very simple 32-bit add that assumes
  * nothing about endianness or native register size. It adds a 16-bit
  * increment value to the value pointed to in the first argument.
+ * tcp_prime() sets up a connection (struct tcb) with everything in its
+ * headers that doesn't change, and tcp_build() makes datagrams for it from
+ * that, so they don't have to be built up from nothing every time.
+ * tcp_gather() does the same for data in pieces elsewhere, which is
+ * checksummed where it lies and sent with slip_gather(), never copied.
  * tcp_template() creates signaling datagrams like SYN, ACK, FIN, etc.
  * You are responsible for sending them.
  * tcp_twiddle() sends a provided datagram and then waits for a requested
- * answer.
+ * answer, retransmitting it if none comes. Anything for our port that
+ * arrives while something else is waiting is only held for us (see
+ * demux.c) if we asked for it with dmx_want().
  * tcp_transmittal() takes a C-string and turns it into a TCP datagram
  * for transmission. You are responsible for sending it.
+ * tcp_patch() puts new sequence and acknowledgement numbers and flags into
+ * a datagram made by either of those, with a new IP ID, fixing up the
+ * checksums as it goes instead of starting over.
+ *
+ * tcp_window() sets the window a connection advertises, which is otherwise
+ * MSS_WINDOW. Set it before the SYN, and if it's too big for the 16 bits
+ * TCP has for it, we ask to scale it (RFC 7323); tcp_agree() then sees
+ * what the other side said about that in its SYN, which tcp_twiddle() left
+ * in tcp_syn, and from then on tc_sscale is how far to shift the windows
+ * it sends us. tcp_advert() puts the current window into a datagram
+ * already built, for when nothing else about it has changed.
+ *
+ * tcp_measure() takes the time a segment took to be acknowledged and works
+ * out the connection's retransmission timeout from that and the ones
+ * before (Jacobson's algorithm, as in RFC 6298), and tcp_backoff() doubles
+ * it when the timer goes off. Time only segments that were sent once, since
+ * there's no telling which of several sends an ACK is for (Karn's rule);
+ * tcp_twiddle() leaves in tcp_took how long its answer took if it could be
+ * timed, and sendq.c times one segment at a time.
+ *
+ * tcp_cookie() puts a TCP Fast Open cookie (RFC 7413) in a connection's
+ * SYN, or asks for one, and tcp_twiddle() leaves any the answer has in
+ * tcp_syn. Keeping them between connections is up to you (see tfo.c).
+ * With a cookie, data can go with the SYN; tcp_hlen() says where.
  */
 
 #include "compat.h"
-#include "tcp.h"
 #include "slip.h"
+#include "tcp.h"
+#include "wheel.h"
+#include "demux.h"
+#include "pbuf.h"
+#include "trace.h"
+
+/* IPv4 identification (see tcp_build) */
+B32 tcp_ipid = -1;
+/* the options of the last SYN tcp_twiddle() got */
+struct tcpsyn tcp_syn;
+/* how long in ms tcp_twiddle() took to get its answer, or -1 if it had to
+   send more than once */
+B32 tcp_took = -1;
 
 /* endian independent 32-bit + 16-bit BE add, very simply implemented */
 int tcp_total32(value, inc)
@@ -27,13 +70,6 @@ SCH *value;
 int inc;
 {
 	int v, w;
-#if DEBUG
-fprintf(stderr, "%02x%02x%02x%02x + %04x = ",
-	(unsigned int)value[0] & 0xff,
-	(unsigned int)value[1] & 0xff,
-	(unsigned int)value[2] & 0xff,
-	(unsigned int)value[3] & 0xff, inc);
-#endif
 
 	/* add lower half */
 	v = inc & 0xff;
@@ -68,181 +104,434 @@ fprintf(stderr, "%02x%02x%02x%02x + %04x = ",
 		}
 	}
 
-#if DEBUG
-fprintf(stderr, "%02x%02x%02x%02x\n",
-	(unsigned int)value[0] & 0xff,
-	(unsigned int)value[1] & 0xff,
-	(unsigned int)value[2] & 0xff,
-	(unsigned int)value[3] & 0xff);
-#endif
 	return value[0]; /* will be zero if overflow occurred */
 }
 
-/* construct a TCP message packet */
-int tcp_template(packet, src, dst, port, sport_h, sport_l, flags, seqno, ackno)
-SCH *packet; /* packet */
+/* set up a connection's headers. everything that stays the same for the
+   life of the connection is filled in here, and summed now so that we
+   don't have to sum it for every datagram. */
+int tcp_prime(tc, src, dst, port, sport_h, sport_l)
+struct tcb *tc; /* connection */
 SCH *src; /* our IPv4 address */
 SCH *dst; /* address to connect to */
 int port; /* port to connect to */
 SCH sport_h; /* bogus source port, high byte */
 SCH sport_l; /* bogus source port, low byte */
-SCH flags; /* flag bits to send, or 2 for a simple ACK */
-SCH *seqno; /* 32 bit sequence number, set to result */
-SCH *ackno; /* 32 bit acknowledgement number, set to result */
 {
-	/* RFC 6864 indicates that pretty much nothing relies on the
-         * uniqueness of the IPv4 ID field anymore. */
-	int j, size;
-	B16 checksum;
+	SCH *packet = tc->tc_head;
+	B32 sum;
 
-	slip_splat(packet, PACKET_SIZE);
+	slip_splat(packet, 40);
 
 	/***** IP header *****/
 	/* version and length of IP header */
 	packet[0] = 0x45;	/* IPv4, 5 32-bit ints == 20 bytes */
-
 	/* TOS as DSCP and ECN: just use zero */
 	packet[1] = 0x00;
+	/* length and identification vary, and fragmentation is none,
+	   not allowed, so they're all zero */
+	/* TTL of 64 */
+	packet[8] = 64;
+	/* protocol is TCP */
+	packet[9] = 6;
+	/* checksum is zero until we compute it */
+	/* source IP */
+	packet[12] = src[0];
+	packet[13] = src[1];
+	packet[14] = src[2];
+	packet[15] = src[3];
+	/* destination IP */
+	packet[16] = dst[0];
+	packet[17] = dst[1];
+	packet[18] = dst[2];
+	packet[19] = dst[3];
 
-	/* compute size of packet. the only option we know and support
- 		is MSS, and that is only sent with SYN. */
-	if (flags & 2) {
-		size = 44;
+	/***** TCP header *****/
+	/* source port. don't care, but store it for checking purposes. */
+	packet[20] = sport_h;
+	packet[21] = sport_l;
+	/* destination port, big endian */
+	packet[22] = (port >> 8) & 0xff;
+	packet[23] = (port & 0xff);
+	/* sequence and acknowledgement numbers, data offset, flags and
+	   window vary */
+	/* checksum comes later; urgent pointer not supported, so zero */
+
+	/* IP checksum of everything but length and ID, which are zero */
+	tc->tc_isum = slip_part(packet, 20, (B32)0);
+	/* TCP checksum of the pseudo-header (addresses and protocol; the
+	   length varies) and ports */
+	sum = slip_part(packet + 12, 8, (B32)6);
+	tc->tc_tsum = slip_part(packet + 20, 4, sum);
+
+	/* one segment's worth of window, unscaled, until told otherwise */
+	tc->tc_rwnd = MSS_WINDOW;
+	tc->tc_rscale = 0;
+	tc->tc_sscale = -1;
+
+	/* nothing timed yet */
+	tc->tc_srtt = -1;
+	tc->tc_rttvar = 0;
+	tc->tc_rto = TCP_RTO;
+
+	/* and no fast open */
+	tc->tc_clen = -1;
+	return 1;
+}
+
+/* send a fast open cookie of len bytes with the SYN, or ask for one if
+   len is zero, or neither if it's -1 */
+int tcp_cookie(tc, cookie, len)
+struct tcb *tc; /* connection from tcp_prime() */
+SCH *cookie; /* the cookie */
+int len; /* its length */
+{
+	int i;
+
+	if (len > TCP_COOKIE || (len > 0 && len < 4))
+		return 0;
+	for(i=0; i<len; i++)
+		tc->tc_cookie[i] = cookie[i];
+	tc->tc_clen = len;
+	return 1;
+}
+
+/* keep a timeout between the line's floor and TCP_RTO_MAX. the floor is
+   TCP_RTO_MIN, plus the time a full segment and a bare ACK take to go over
+   the line at ten bits a byte, since nothing can come back sooner. */
+B32 tcp_clamp(rto)
+B32 rto;
+{
+	B32 least;
+
+	least = TCP_RTO_MIN;
+	if (slip_baud > 0)
+		least += (B32)(MSS_WINDOW + 80) * 10000L / slip_baud;
+	if (rto < least)
+		rto = least;
+	if (rto > TCP_RTO_MAX)
+		rto = TCP_RTO_MAX;
+	return rto;
+}
+
+/* take a round trip time of ms. srtt is kept times 8 and rttvar times 4,
+   so the gains of 1/8 and 1/4 are shifts, and the timeout is srtt plus
+   four times rttvar. */
+int tcp_measure(tc, ms)
+struct tcb *tc; /* connection from tcp_prime() */
+B32 ms; /* how long it took */
+{
+	B32 delta;
+
+	if (ms < 0)
+		return 0;
+	if (tc->tc_srtt < 0) {
+		/* the first: srtt is it, and rttvar half of it */
+		tc->tc_srtt = ms << 3;
+		tc->tc_rttvar = ms << 1;
 	} else {
-		size = 40;
+		delta = ms - (tc->tc_srtt >> 3);
+		tc->tc_srtt += delta;
+		if (delta < 0)
+			delta = -delta;
+		tc->tc_rttvar += delta - (tc->tc_rttvar >> 2);
 	}
-	packet[2] = (size >> 8) & 0xff;
-	packet[3] = (size & 0x00ff);
+	tc->tc_rto = tcp_clamp((tc->tc_srtt >> 3) + tc->tc_rttvar);
+	TRACE(TR_RTT, ms, tc->tc_rto);
+	return 1;
+}
 
-	/* identification, big endian (see above) */
-	packet[4] = rand() & 0xff;
-	packet[5] = rand() & 0xff;
+/* the timer went off: wait twice as long next time. this lasts until the
+   next round trip we can time. */
+int tcp_backoff(tc)
+struct tcb *tc; /* connection from tcp_prime() */
+{
+	tc->tc_rto = tcp_clamp(tc->tc_rto << 1);
+	return 1;
+}
 
-	/* fragmentation: none, not allowed */
-	packet[6] = 0;
-	packet[7] = 0;
+/* advertise wnd bytes of window from now on. before the SYN, this is also
+   what decides if we ask to scale it. */
+int tcp_window(tc, wnd)
+struct tcb *tc; /* connection from tcp_prime() */
+B32 wnd; /* window, in bytes */
+{
+	tc->tc_rwnd = wnd;
+	if (tc->tc_sscale < 0) {
+		for(tc->tc_rscale=0; tc->tc_rscale<14 &&
+				(wnd >> tc->tc_rscale) > 65535L;
+				tc->tc_rscale++)
+			;
+	}
+	return 1;
+}
 
-	/* come back to the rest at the end */
+/* once the handshake is done, see if the window scale we asked for is on:
+   it is only if they sent one too */
+int tcp_agree(tc)
+struct tcb *tc; /* connection from tcp_prime() */
+{
+	if (!tc->tc_rscale || tcp_syn.sy_ws < 0) {
+		tc->tc_rscale = 0;
+		tc->tc_sscale = 0;
+	} else
+		tc->tc_sscale = (tcp_syn.sy_ws > 14) ? 14 :
+			tcp_syn.sy_ws;
+	return 1;
+}
 
-	/***** TCP pseudo-header *****/
-	/* we put this here so we can compute the checksum early, and then
-           fill in our IP information and checksum that at the end. */
+/* how long our headers are: 40 bytes, plus the MSS option on a SYN, plus
+   a window scale option if we're asking for one, plus the fast open option
+   if we're sending one, padded out to a multiple of four */
+int tcp_hlen(tc, flags)
+struct tcb *tc; /* connection from tcp_prime() */
+SCH flags; /* flag bits to send */
+{
+	int n;
+
+	if (!(flags & 2))
+		return 40;
+	n = (tc->tc_rscale) ? 48 : 44;
+	if (tc->tc_clen >= 0)
+		n += (tc->tc_clen + 5) & ~3;
+	return n;
+}
 
-	/* source IP */
-	packet[8] = src[0];
-	packet[9] = src[1];
-	packet[10] = src[2];
-	packet[11] = src[3];
+/* the window as it goes in the header. the one with a SYN isn't scaled. */
+B32 tcp_wfield(tc, flags)
+struct tcb *tc;
+SCH flags;
+{
+	B32 w;
 
-	/* destination IP */
-	packet[12] = dst[0];
-	packet[13] = dst[1];
-	packet[14] = dst[2];
-	packet[15] = dst[3];
-
-	/* explicit zero */
-	packet[16] = 0;
-	/* protocol, always 6 for TCP */
-	packet[17] = 6;
-	/* length,  minus IP header */
-	packet[18] = ((size - 20) >> 8) & 0xff;
-	packet[19] = ((size - 20) & 0x00ff);
-
-	/***** TCP payload *****/
-	/* source port. don't care, but store it for checking purposes. */
-	packet[20] = sport_h;
-	packet[21] = sport_l;
+	w = (flags & 2) ? tc->tc_rwnd : (tc->tc_rwnd >> tc->tc_rscale);
+	return (w > 65535L) ? 65535L : w;
+}
 
-	/* destination port, big endian */
-	packet[22] = (port >> 8) & 0xff;
-	packet[23] = (port & 0xff);
+/* construct a datagram on a connection from its prebuilt headers. len
+   bytes of data, if any, must already be in the packet after the headers
+   (which are 40 bytes long, or more for a SYN, because of its options; see
+   tcp_hlen()). returns the size, or zero if it's too big. */
+int tcp_build(tc, packet, flags, seqno, ackno, len)
+struct tcb *tc; /* connection from tcp_prime() */
+SCH *packet; /* packet */
+SCH flags; /* flag bits to send */
+SCH *seqno; /* 32 bit sequence number */
+SCH *ackno; /* 32 bit acknowledgement number */
+int len; /* data length */
+{
+	struct frag f[2];
+
+	f[0].fr_data = packet;
+	f[1].fr_data = packet + tcp_hlen(tc, flags);
+	f[1].fr_size = len;
+	return tcp_gather(tc, f, flags, seqno, ackno, 2);
+}
+
+/* likewise, but the data is in the pieces frag[1] to frag[n-1], wherever
+   they are, and the headers go in frag[0], which must have room for them.
+   the data is only added up, not copied, so send the datagram with
+   slip_gather(frag, n). returns the size, or zero if it's too big. */
+int tcp_gather(tc, frag, flags, seqno, ackno, n)
+struct tcb *tc; /* connection from tcp_prime() */
+struct frag *frag; /* headers, then data */
+SCH flags; /* flag bits to send */
+SCH *seqno; /* 32 bit sequence number */
+SCH *ackno; /* 32 bit acknowledgement number */
+int n; /* how many pieces, including the headers */
+{
+	int i, j, size;
+	B32 sum, w;
+	B32 m = (B32)65535;
+	SCH *packet;
+
+	/* the only options we know and support are MSS, window scale and
+	   fast open, and those are only sent with SYN */
+	packet = frag[0].fr_data;
+	frag[0].fr_size = tcp_hlen(tc, flags);
+	size = 0;
+	for(i=0; i<n; i++)
+		size += frag[i].fr_size;
+	if (size >= PACKET_SIZE)
+		return 0;
+	for(i=0; i<40; i++)
+		packet[i] = tc->tc_head[i];
+
+	/* length, big endian */
+	packet[2] = (size >> 8) & 0xff;
+	packet[3] = (size & 0x00ff);
+
+	/* identification, big endian. RFC 6864 indicates that pretty much
+	   nothing relies on the uniqueness of the IPv4 ID field anymore, so
+	   we just count. we could make this random, but counting up means
+	   CSLIP can leave it out of compressed headers. */
+	if (tcp_ipid < 0)
+		tcp_ipid = rand() & 0xffff;
+	tcp_ipid = (tcp_ipid + 1) & 0xffff;
+	packet[4] = (tcp_ipid >> 8) & 0xff;
+	packet[5] = (tcp_ipid & 0xff);
 
 	/* sequence number, big endian */
 	packet[24] = seqno[0];
 	packet[25] = seqno[1];
 	packet[26] = seqno[2];
 	packet[27] = seqno[3];
-
 	/* acknowledgement number, big endian */
 	packet[28] = ackno[0];
 	packet[29] = ackno[1];
 	packet[30] = ackno[2];
 	packet[31] = ackno[3];
-
 	/* data offset, > 5 if SYN options present, plus reserved nybble */
-	packet[32] = (flags & 2) ? 96 : 80; /* 0x60 vs 0x50 */
+	packet[32] = (frag[0].fr_size - 20) << 2; /* 0x50, 0x60 or 0x70 */
 	/* flag bits */
 	packet[33] = flags;
-	/* MSS/window value, big endian */
-	packet[34] = ((MSS_WINDOW >> 8) & 0xff);
-	packet[35] = (MSS_WINDOW & 0xff);
-
-	/* we'll come back to the checksum at the end */
-
-	/* urgent pointer, not supported even if URG set, make zero */
-	packet[38] = 0;
-	packet[39] = 0;
-
-	/* options. only if sending a SYN, and we only support MSS. */
+	/* window, big endian */
+	w = tcp_wfield(tc, flags);
+	packet[34] = (w >> 8) & 0xff;
+	packet[35] = (w & 0xff);
 	if (flags & 2) {
 		packet[40] = 2;
 		packet[41] = 4;
-		packet[42] = packet[34];
-		packet[43] = packet[35];
+		packet[42] = ((MSS_WINDOW >> 8) & 0xff);
+		packet[43] = (MSS_WINDOW & 0xff);
+		j = 44;
+		if (tc->tc_rscale) {
+			packet[j++] = 1; /* NOP, to keep it aligned */
+			packet[j++] = 3;
+			packet[j++] = 3;
+			packet[j++] = tc->tc_rscale;
+		}
+		if (tc->tc_clen >= 0) {
+			/* NOPs first, so it ends on a multiple of four */
+			while (frag[0].fr_size - j > tc->tc_clen + 2)
+				packet[j++] = 1;
+			packet[j++] = 34;
+			packet[j++] = tc->tc_clen + 2;
+			for(i=0; i<tc->tc_clen; i++)
+				packet[j++] = tc->tc_cookie[i];
+		}
 	}
 
-	/* compute TCP checksum (with checksum field = 0) */
-	/* including pseudo header */
-	/* pad null in checksum if not even 16-bit boundary */
-	checksum = slip_sum(packet + 8, size - 8);
-	packet[36] = (checksum >> 8) & 0xff;
-	packet[37] = (checksum & 0x00ff); 
-
-	/***** finish IP packet ****/
-	/* TTL of 64 */
-	packet[8] = 64;
-	
-	/* protocol is TCP */
-	packet[9] = 6;
+	/* TCP checksum: the fixed part, the length for the pseudo-header,
+	   the numbers, flags and window, then options and data, all of which
+	   start at even offsets */
+	sum = tc->tc_tsum + (B32)(size - 20);
+	sum = slip_part(packet + 24, 12, sum);
+	sum = slip_part(packet + 40, frag[0].fr_size - 40, sum);
+	sum += slip_frag(frag + 1, n - 1);
+	while (sum > m)
+		sum = (sum & m) + ((sum >> 16) & m);
+	sum ^= m;
+	packet[36] = (sum >> 8) & 0xff;
+	packet[37] = (sum & 0x00ff);
+
+	/* IP checksum: the fixed part, length and ID */
+	sum = tc->tc_isum + (B32)size + tcp_ipid;
+	while (sum > m)
+		sum = (sum & m) + ((sum >> 16) & m);
+	sum ^= m;
+	packet[10] = (sum >> 8) & 0xff;
+	packet[11] = (sum & 0x00ff);
+	return size;
+}
 
-	/* zero out checksum */
-	packet[10] = 0;
-	packet[11] = 0;
+/* one connection for the callers that don't keep their own */
+struct tcb tcp_last;
 
-	/* source IP */
-	packet[12] = src[0];
-	packet[13] = src[1];
-	packet[14] = src[2];
-	packet[15] = src[3];
+/* construct a TCP message packet */
+int tcp_template(packet, src, dst, port, sport_h, sport_l, flags, seqno, ackno)
+SCH *packet; /* packet */
+SCH *src; /* our IPv4 address */
+SCH *dst; /* address to connect to */
+int port; /* port to connect to */
+SCH sport_h; /* bogus source port, high byte */
+SCH sport_l; /* bogus source port, low byte */
+SCH flags; /* flag bits to send, or 2 for a simple ACK */
+SCH *seqno; /* 32 bit sequence number, set to result */
+SCH *ackno; /* 32 bit acknowledgement number, set to result */
+{
+	tcp_prime(&tcp_last, src, dst, port, sport_h, sport_l);
+	return tcp_build(&tcp_last, packet, flags, seqno, ackno, 0);
+}
 
-	/* destination IP */
-	packet[16] = dst[0];
-	packet[17] = dst[1];
-	packet[18] = dst[2];
-	packet[19] = dst[3];
+/* how far the 32-bit big endian sequence number a is past b, wrapping
+   around as sequence numbers do, or -1 if it's 65536 or more (or before
+   b). like tcp_total32(), it goes a byte at a time, so nothing can
+   overflow. */
+B32 tcp_past(a, b)
+SCH *a;
+SCH *b;
+{
+	int i, d, borrow;
+	B32 n;
+
+	n = 0;
+	borrow = 0;
+	for(i=3; i>=0; i--) {
+		d = (a[i] & 0xff) - (b[i] & 0xff) - borrow;
+		borrow = (d < 0);
+		d &= 0xff;
+		if (i < 2 && d)
+			return -1;
+		if (i >= 2)
+			n |= (B32)d << ((3 - i) * 8);
+	}
+	return n;
+}
 
-	/* compute IP checksum (with checksum field = 0) */
-	checksum = slip_sum(packet, 20);
-	packet[10] = (checksum >> 8) & 0xff;
-	packet[11] = (checksum & 0x00ff); 
-	return size;
+/* the options of a SYN we got, for tcp_agree() and whoever wants its
+   fast open cookie, and its ackno */
+int tcp_synopt(packet, size)
+SCH *packet;
+int size;
+{
+	int i, j, end, len;
+
+	tcp_syn.sy_ws = -1;
+	tcp_syn.sy_clen = -1;
+	for(i=0; i<4; i++)
+		tcp_syn.sy_ackno[i] = packet[28 + i];
+	end = 20 + ((packet[32] >> 2) & 0x3c);
+	if (end > size)
+		end = size;
+	for(i=40; i<end; i+=len) {
+		if (packet[i] == 0) /* end of options */
+			break;
+		if (packet[i] == 1) { /* NOP */
+			len = 1;
+			continue;
+		}
+		if (i + 1 >= end || (len = packet[i + 1] & 0xff) < 2 ||
+				i + len > end)
+			break;
+		if (packet[i] == 3 && len == 3)
+			tcp_syn.sy_ws = packet[i + 2] & 0xff;
+		if (packet[i] == 34 && len >= 6 && len <= TCP_COOKIE + 2) {
+			tcp_syn.sy_clen = len - 2;
+			for(j=0; j<len-2; j++)
+				tcp_syn.sy_cookie[j] = packet[i + 2 + j];
+		}
+	}
+	return 1;
 }
 
-int tcp_twiddle(packet, size, waitfor, seqno, ackno, inc, err)
+int tcp_twiddle(packet, size, waitfor, seqno, ackno, inc, rto, err)
 SCH *packet; /* packet to send */
 int size; /* size of packet */
 SCH waitfor; /* flags to await */
 SCH *seqno; /* 32 bit sequence number, set to result */
 SCH *ackno; /* 32 bit acknowledgement number, set to result */
 int inc;    /* value to increase seqno by, if any */
+B32 rto;    /* ms to wait before sending again the first time */
 SCH *err;    /* error buffer */
 {
-	int j, rsize;
-	B16 checksum;
+	int i, j, rsize, tries, late;
+	B32 sport, start;
 	SCH *reply;
+	struct timer t;
 
 	/* allocate reply packet */
-	reply = malloc(PACKET_SIZE);
+	reply = pb_get();
 	if (!reply)
 		return TCP_NOMEM;
 
@@ -250,99 +539,96 @@ SCH *err;    /* error buffer */
 	/* any errors we report would be fatal anyway */
 	tcp_total32(seqno, inc);
 
-	/* we assume nothing about timers. if we get an unexpected packet, */
-	/* we simply retransmit the passed packet immediately */
+	/* how much data we're sending, if any */
+	late = size - 20 - ((packet[32] >> 2) & 0x3c);
+
+	/* our port, which is where the replies we want go */
+	sport = packet[20] & 0xff;
+	sport = (sport << 8) | (packet[21] & 0xff);
+
+	/* send the packet, and send it again each time the retransmission
+	   timer goes off with no answer, waiting twice as long each time.
+	   unexpected packets are simply ignored; they used to trigger an
+	   immediate retransmit, but that just floods a slow line with
+	   duplicates. */
+	t.tw_live = 0;
+	tries = 0;
+	start = wheel_now();
 	for(;;) {
-		if(!slip_ship(packet, size)) {
-			*err = TCP_SLIP_ERROR;
-			free(reply);
-			return 0;
+		if (!t.tw_live) {
+			if (tries++ == TCP_TRIES) {
+				TRACE(TR_TIMEOUT, TCP_TRIES, 0);
+				*err = TCP_TIMEOUT;
+				pb_free(reply);
+				return 0;
+			}
+			if (tries > 1)
+				TRACE(TR_REXMIT, tries - 1, size);
+			if(!slip_ship(packet, size)) {
+				*err = TCP_SLIP_ERROR;
+				pb_free(reply);
+				return 0;
+			}
+			wheel_arm(&t, rto, 0, 0);
+			rto = (rto << 1 > TCP_RTO_MAX) ? TCP_RTO_MAX : rto << 1;
 		}
 
-		rsize = slip_slurp(reply, PACKET_SIZE);
-		if (!rsize) { /* something is wrong */
+		rsize = dmx_recv(reply, PACKET_SIZE, DMX_TCP, sport);
+		if (!rsize) {
+			if (slip_fault == SLIP_TIMEOUT)
+				continue;
+			/* something is wrong */
+			wheel_drop(&t);
 			*err = TCP_SLIP_ERROR;
-			free(reply);
+			pb_free(reply);
 			return 0;
 		}
 
 		/* we are expecting some sort of control packet, which all
-			have an even length. kick out here since that
-			simplifies the checksum portion. */
+			have an even length */
 		if (rsize & 1) continue;
 
-		j = reply[9]; /* hold for a moment */
-
-		/* verify its checksum by reconstructing the pseudo-header */
-		/* source IP */
-		reply[8] = reply[12];
-		reply[9] = reply[13];
-		reply[10] = reply[14];
-		reply[11] = reply[15];
-
-		/* destination IP */
-		reply[12] = reply[16];
-		reply[13] = reply[17];
-		reply[14] = reply[18];
-		reply[15] = reply[19];
-
-		/* zero, TCP, packet length */
-		reply[16] = 0;
-		reply[17] = 6;
-		reply[18] = ((rsize - 20) >> 8) & 0xff;
-		reply[19] = ((rsize - 20) & 0x00ff);
-		checksum = slip_sum(reply + 8, rsize - 8);
-		if (checksum) { /* RFC 1071 */
-#if DEBUG
-			fprintf(stderr, "tcp: checksum failed\n");
-#endif
-			continue;
-		}
-
 		/* fast kickouts */
-		/* reject non-TCP */
-		if (j != 6)
+		/* (it's TCP to our port, or we wouldn't have it) */
+		/* verify its checksum */
+		if (!slip_valid(reply, rsize)) {
+			TRACE(TR_CSUM, 6, rsize);
 			continue;
+		}
 		/* if we get an RST, cancel */
 		if (reply[33] & 4) {
-#if DEBUG
-			fprintf(stderr, "tcp: bailing on RST\n");
-#endif
+			TRACE(TR_RST, ((packet[22] & 0xff) << 8) |
+				(packet[23] & 0xff), reply[33] & 0xff);
+			wheel_drop(&t);
 			j = reply[33];
-			free(reply);
+			pb_free(reply);
 			return j;
 		}
-		/* reject wrong port number */
-		if (packet[20] != reply[22] || packet[21] != reply[23])
-			continue;
 		/* if we are waiting for something with an ACK in it, reject */
-		/* if the ackno != ++seqno (we already bumped it) */
+		/* if the ackno != ++seqno (we already bumped it), or isn't
+		   past it by no more than the data we sent (which only a SYN
+		   has, with fast open; see tcp_syn.sy_ackno) */
 		if (waitfor & 16) {
-			if (reply[28] != seqno[0] ||
-					reply[29] != seqno[1] ||
-					reply[30] != seqno[2] ||
-					reply[31] != seqno[3]) {
-#if DEBUG
-fprintf(stderr, "tcp: unexpected seqno %02x%02x%02x%02x != %02x%02x%02x%02x\n",
-(unsigned int)seqno[0] & 0xff,
-(unsigned int)seqno[1] & 0xff,
-(unsigned int)seqno[2] & 0xff,
-(unsigned int)seqno[3] & 0xff,
-(unsigned int)reply[28] & 0xff,
-(unsigned int)reply[29] & 0xff,
-(unsigned int)reply[30] & 0xff,
-(unsigned int)reply[31] & 0xff);
-#endif
+			j = 0;
+			for(i=0; i<4; i++) {
+				if (reply[28 + i] != seqno[i])
+					j = 1;
+			}
+			if (j && (!late ||
+					tcp_past(reply + 28, seqno) < 0 ||
+					tcp_past(reply + 28, seqno) > late)) {
+				TRACE(TR_SEQ, trace_word(seqno),
+					trace_word(reply + 28));
 				continue;
 			}
 		}
 		/* if we're waiting for a plain ACK, but get a FIN, bail */
 		if (waitfor == 16 && (reply[33] & 1)) {
-#if DEBUG
-			fprintf(stderr, "tcp: bailing on FIN\n");
-#endif
+			TRACE(TR_FIN, ((packet[22] & 0xff) << 8) |
+				(packet[23] & 0xff), reply[33] & 0xff);
+			wheel_drop(&t);
 			j = reply[33];
-			free(reply);
+			pb_free(reply);
 			return j;
 		}
 		/* otherwise if this is not the flags we want, loop */
@@ -350,10 +636,18 @@ fprintf(stderr, "tcp: unexpected seqno %02x%02x%02x%02x != %02x%02x%02x%02x\n",
 		if (reply[33] != waitfor && (reply[33] != (waitfor | 8)))
 			continue;
 
-		/* we have a packet that purports to be our reply */
+		/* we have a packet that purports to be our reply. if we
+		   only sent once, it's how long a round trip takes. */
+		wheel_drop(&t);
+		tcp_took = (tries == 1) ? wheel_now() - start : -1;
 		break;
 	}
 
+	/* a SYN may ask to scale windows, or give us a fast open cookie;
+	   keep what it says */
+	if (reply[33] & 2)
+		tcp_synopt(reply, rsize);
+
 	/* the reply's ackno matches our seqno, so leave that in seqno */
 	/* return the reply's seqno in ackno */
 	ackno[0] = reply[24];
@@ -361,7 +655,7 @@ fprintf(stderr, "tcp: unexpected seqno %02x%02x%02x%02x != %02x%02x%02x%02x\n",
 	ackno[2] = reply[26];
 	ackno[3] = reply[27];
 	j = reply[33];
-	free(reply);
+	pb_free(reply);
 	return j;
 }
 
@@ -377,122 +671,64 @@ SCH *seqno; /* 32 bit sequence number, set to result */
 SCH *ackno; /* 32 bit acknowledgement number, set to result */
 SCH *str; /* string being sent, which may be empty but not NULL*/
 {
-	int j, size;
-	B16 checksum;
+	int j;
 
-	slip_splat(packet, PACKET_SIZE);
-	/* version and length of IP header */
-	packet[0] = 0x45;	/* IPv4, 5 32-bit ints == 20 bytes */
-	/* TOS as DSCP and ECN: just use zero */
-	packet[1] = 0x00;
-	/* size of packet: IP, TCP and string, plus CRLF if any */
-	size = 40 + strlen(str);
-	if (size >= PACKET_SIZE)
+	/* text payload */
+	j = strlen((char *)str);
+	if (40 + j >= PACKET_SIZE - 1)
 		return 0;
+	slip_move(packet + 40, str, j);
+	tcp_prime(&tcp_last, src, dst, port, sport_h, sport_l);
+	return tcp_build(&tcp_last, packet, 24, seqno, ackno, j);
+}
 
-	packet[2] = (size >> 8) & 0xff;
-	packet[3] = (size & 0x00ff);
-
-	/* identification, big endian (see above) */
-	packet[4] = rand() & 0xff;
-	packet[5] = rand() & 0xff;
-
-	/* fragmentation: none, not allowed */
-	packet[6] = 0;
-	packet[7] = 0;
-
-	/* come back to the rest at the end */
-	/* pseudo-header follows */
-	/* source IP */
-	packet[8] = src[0];
-	packet[9] = src[1];
-	packet[10] = src[2];
-	packet[11] = src[3];
-	/* destination IP */
-	packet[12] = dst[0];
-	packet[13] = dst[1];
-	packet[14] = dst[2];
-	packet[15] = dst[3];
-	/* explicit zero */
-	packet[16] = 0;
-	/* protocol, always 6 for TCP */
-	packet[17] = 6;
-	/* length,  minus IP header */
-	packet[18] = ((size - 20) >> 8) & 0xff;
-	packet[19] = ((size - 20) & 0x00ff);
-
-	/* TCP header */
-	/* source port */
-	packet[20] = sport_h;
-	packet[21] = sport_l;
-	/* destination port, big endian */
-	packet[22] = (port >> 8) & 0xff;
-	packet[23] = (port & 0xff);
-	/* sequence number, big endian */
-	packet[24] = seqno[0];
-	packet[25] = seqno[1];
-	packet[26] = seqno[2];
-	packet[27] = seqno[3];
-	/* acknowledgement number, big endian */
-	packet[28] = ackno[0];
-	packet[29] = ackno[1];
-	packet[30] = ackno[2];
-	packet[31] = ackno[3];
-
-	/* data offset, always 80 */
-	packet[32] = 80;
-	/* flag bits, always PSH + ACK */
-	packet[33] = 24;
-	/* MSS/window value, big endian */
-	packet[34] = ((MSS_WINDOW >> 8) & 0xff);
-	packet[35] = (MSS_WINDOW & 0xff);
-
-	/* we'll come back to the checksum at the end */
-	/* urgent pointer, not supported */
-	packet[38] = 0;
-	packet[39] = 0;
-
-	/* text payload: append string and (if any) CRLF */
-	if (strlen(str)) {
-		for(j=0;j<strlen(str);j++) {
-			packet[40+j] = str[j];
-		}
-	} else j=0;
-
-	/* compute TCP checksum (with checksum field = 0) */
-	/* including pseudo header */
-	/* pad null in checksum if not even 16-bit boundary */
-	if (size & 1) {
-		packet[42+j] = 0;
-		checksum = slip_sum(packet + 8, size - 7);
-	} else {
-		checksum = slip_sum(packet + 8, size - 8);
+/* patch an already built datagram with a new seqno and/or ackno (either
+   may be NULL to leave it be) and flags (or zero to leave them be), and a
+   new IP ID, and adjust the TCP and IP checksums to match (RFC 1624). this
+   is much cheaper than building the datagram again, which is what it's
+   for: the ACKs we send while receiving differ only in these. */
+int tcp_patch(packet, seqno, ackno, flags)
+SCH *packet; /* packet from tcp_template() or tcp_transmittal() */
+SCH *seqno; /* 32 bit sequence number, or NULL */
+SCH *ackno; /* 32 bit acknowledgement number, or NULL */
+SCH flags; /* flag bits, or zero */
+{
+	SCH id[2];
+
+	/* the TCP checksum counts from the pseudo-header, 8 bytes in, so
+	   these fields are all at even distances from it */
+	if (seqno)
+		slip_mend(packet + 36, packet + 24, seqno, 4);
+	if (ackno)
+		slip_mend(packet + 36, packet + 28, ackno, 4);
+	if (flags) {
+		/* flags share a word with the data offset */
+		id[0] = packet[32];
+		id[1] = flags;
+		slip_mend(packet + 36, packet + 32, id, 2);
 	}
-	packet[36] = (checksum >> 8) & 0xff;
-	packet[37] = (checksum & 0x00ff); 
 
-	/* finish IP packet */
-	/* TTL of 64 */
-	packet[8] = 64;
-	/* protocol is TCP */
-	packet[9] = 6;
-	/* zero out checksum */
-	packet[10] = 0;
-	packet[11] = 0;
-	/* source IP */
-	packet[12] = src[0];
-	packet[13] = src[1];
-	packet[14] = src[2];
-	packet[15] = src[3];
-	/* destination IP */
-	packet[16] = dst[0];
-	packet[17] = dst[1];
-	packet[18] = dst[2];
-	packet[19] = dst[3];
-	/* compute IP checksum (with checksum field = 0) */
-	checksum = slip_sum(packet, 20);
-	packet[10] = (checksum >> 8) & 0xff;
-	packet[11] = (checksum & 0x00ff); 
+	/* new IP ID, and the IP header checksum (see tcp_build) */
+	tcp_ipid = (tcp_ipid + 1) & 0xffff;
+	id[0] = (tcp_ipid >> 8) & 0xff;
+	id[1] = (tcp_ipid & 0xff);
+	slip_mend(packet + 10, packet + 4, id, 2);
+	return 1;
+}
 
-	return size;
+/* patch the window a connection advertises now into a datagram built for
+   it (but not a SYN) */
+int tcp_advert(tc, packet)
+struct tcb *tc; /* connection from tcp_prime() */
+SCH *packet; /* packet from tcp_build() */
+{
+	SCH w[2];
+	B32 v;
+
+	v = tcp_wfield(tc, (SCH)16);
+	w[0] = (v >> 8) & 0xff;
+	w[1] = (v & 0xff);
+	if (w[0] != packet[34] || w[1] != packet[35])
+		slip_mend(packet + 36, packet + 34, w, 2);
+	return 1;
 }
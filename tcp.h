@@ -1,24 +1,109 @@
+/* the longest TCP Fast Open cookie (RFC 7413) */
+#define TCP_COOKIE	16
+
+/* a connection: the parts of its IP and TCP headers that never change,
+   and their partial checksums (see slip_part()), set up by tcp_prime(),
+   and the window we advertise on it (see tcp_window()) */
+struct tcb {
+	SCH tc_head[40];
+	B32 tc_isum;	/* IP header, less length and ID */
+	B32 tc_tsum;	/* pseudo-header and ports */
+	B32 tc_rwnd;	/* our window, in bytes */
+	int tc_rscale;	/* how far we shift it (RFC 7323); offered with SYN */
+	int tc_sscale;	/* how far to shift theirs, or -1 until tcp_agree() */
+	B32 tc_srtt;	/* smoothed round trip time in ms, times 8, or -1 */
+	B32 tc_rttvar;	/* and its mean deviation, times 4 */
+	B32 tc_rto;	/* retransmission timeout in ms (see tcp_measure()) */
+	int tc_clen;	/* fast open cookie to send with SYN: its length, 0 to
+			   ask for one, or -1 for neither (see tcp_cookie()) */
+	SCH tc_cookie[TCP_COOKIE];
+};
+
+/* what the last SYN tcp_twiddle() got said, besides MSS */
+struct tcpsyn {
+	int sy_ws;	/* window scale (see tcp_agree()), or -1 if none */
+	int sy_clen;	/* fast open cookie length, or -1 if none */
+	SCH sy_cookie[TCP_COOKIE];
+	SCH sy_ackno[4];	/* its ackno, which says if it took our data */
+};
+
 #if __GNUC__
 int tcp_total32(SCH *value, int inc);
 int tcp_template(SCH *packet, SCH *src, SCH *dst, int port, SCH sport_h, SCH sport_l, SCH flags, SCH *seqno, SCH *ackno);
 int tcp_transmittal(SCH *packet, SCH *src, SCH *dst, int port, SCH sport_h, SCH sport_l, SCH *seqno, SCH *ackno, SCH *string);
-int tcp_twiddle(SCH *packet, int size, SCH waitfor, SCH *seqno, SCH *ackno, int inc, SCH *err);
+int tcp_twiddle(SCH *packet, int size, SCH waitfor, SCH *seqno, SCH *ackno, int inc, B32 rto, SCH *err);
+int tcp_patch(SCH *packet, SCH *seqno, SCH *ackno, SCH flags);
+int tcp_prime(struct tcb *tc, SCH *src, SCH *dst, int port, SCH sport_h, SCH sport_l);
+int tcp_build(struct tcb *tc, SCH *packet, SCH flags, SCH *seqno, SCH *ackno, int len);
+int tcp_gather(struct tcb *tc, struct frag *frag, SCH flags, SCH *seqno, SCH *ackno, int n);
+int tcp_window(struct tcb *tc, B32 wnd);
+int tcp_agree(struct tcb *tc);
+int tcp_advert(struct tcb *tc, SCH *packet);
+int tcp_measure(struct tcb *tc, B32 ms);
+int tcp_backoff(struct tcb *tc);
+int tcp_cookie(struct tcb *tc, SCH *cookie, int len);
+int tcp_hlen(struct tcb *tc, SCH flags);
 #else
 int tcp_total32();
 int tcp_template();
 int tcp_transmittal();
 int tcp_twiddle();
+int tcp_patch();
+int tcp_prime();
+int tcp_build();
+int tcp_gather();
+int tcp_window();
+int tcp_agree();
+int tcp_advert();
+int tcp_measure();
+int tcp_backoff();
+int tcp_cookie();
+int tcp_hlen();
 #endif
 
-#define PACKET_SIZE 1536
+extern struct tcpsyn tcp_syn;
+extern B32 tcp_took;
 
-/* we use the same MSS and window. many SLIP implementations use 1006
-   bytes, but this is for slow systems which may have small buffers. if you
-   get disconnects, try going with even less. however, this also limits
-   how much you can send with minisock, since it only knows to transmit
-   everything in one big TCP datagram at the very beginning. if we make a
-   future version, we should try to do something different for sends. */
+/* the biggest datagram we build or take, which is what fits in a buffer
+   from the pool (see pbuf.h) */
+#define PACKET_SIZE PB_SIZE
+/* the biggest control packet we make (a SYN with MSS, window scale and a
+   fast open cookie) */
+#define TCP_CONTROL 68
+
+/* our MSS, and the window unless tcp_window() says otherwise. many SLIP
+   implementations use 1006 bytes, but this is for slow systems which may
+   have small buffers. if you get disconnects, try going with even less. it
+   is also the biggest segment we send (see sendq.c), whatever the other
+   side's MSS. */
 #define MSS_WINDOW 256
 
 #define	TCP_NOMEM	1
 #define	TCP_SLIP_ERROR	2
+#define	TCP_TIMEOUT	3
+#define	TCP_READ_ERROR	4	/* a send queue couldn't read its file */
+
+/* retransmission timeout in ms until we've timed a round trip, and how
+   many times we send a datagram before giving up on the other side. each
+   time it goes unanswered, the timeout doubles, up to TCP_RTO_MAX. once
+   we've timed some, it's worked out from those (RFC 6298), but never less
+   than TCP_RTO_MIN plus however long a full segment and its ACK take to
+   send at the line rate. */
+#ifndef TCP_RTO
+#define TCP_RTO		3000
+#endif
+#ifndef TCP_RTO_MIN
+#define TCP_RTO_MIN	500
+#endif
+#ifndef TCP_RTO_MAX
+#define TCP_RTO_MAX	16000
+#endif
+#ifndef TCP_TRIES
+#define TCP_TRIES	6
+#endif
+
+/* how long in ms we may hold back an ACK, hoping for more to acknowledge
+   or data to send it with. RFC 1122 says no more than 500. */
+#ifndef TCP_DELACK
+#define TCP_DELACK	200
+#endif
@@ -0,0 +1,147 @@
+/* TCP Fast Open cookie cache for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * A server that does TCP Fast Open (RFC 7413) gives us a cookie when we ask
+ * for one in a SYN, and if we send it back in the SYN of a later
+ * connection, it takes the data that comes with it, which saves a round
+ * trip before the first of what we send gets there. Cookies are per server,
+ * and we're a new process each time, so they're kept in a file.
+ *
+ * tfo_load() finds the cookie for a server, if we have one, and tfo_save()
+ * keeps one, or forgets it if the length is zero (say, if a SYN with it
+ * got no answer). The file is BASS_TFO from the environment, or .bass_tfo
+ * in your home directory. Each line is a server's address and its cookie
+ * in hex, most recently saved first, and only TFO_LINES are kept. If there
+ * is no file, or it can't be written, we just do without.
+ */
+
+#include "compat.h"
+#include "slip.h"
+#include "tcp.h"
+#include "tfo.h"
+
+#if !__GNUC__
+char *getenv();
+#endif
+
+/* a line is the address, a space, the cookie in hex and a newline */
+#define TFO_LINE	(16 + 2 * TCP_COOKIE + 2)
+
+char tfo_file[256];
+char tfo_keep[TFO_LINES][TFO_LINE];
+
+/* where the cache is, or NULL if there's nowhere */
+char *tfo_path()
+{
+	char *p;
+
+	p = getenv("BASS_TFO");
+	if (p)
+		return (*p) ? p : NULL;
+	p = getenv("HOME");
+	if (!p || strlen(p) + 12 > sizeof(tfo_file))
+		return NULL;
+	sprintf(tfo_file, "%s/.bass_tfo", p);
+	return tfo_file;
+}
+
+/* if line is for dst, the address part of it, else zero */
+int tfo_mine(line, dst)
+char *line;
+SCH *dst;
+{
+	char a[20];
+
+	sprintf(a, "%d.%d.%d.%d ", dst[0] & 0xff, dst[1] & 0xff,
+		dst[2] & 0xff, dst[3] & 0xff);
+	return (strncmp(line, a, strlen(a))) ? 0 : strlen(a);
+}
+
+/* one hex digit, or -1 */
+int tfo_hex(c)
+int c;
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/* put the cookie for dst in cookie, which has room for TCP_COOKIE bytes.
+   returns its length, or zero if we haven't one. */
+int tfo_load(dst, cookie)
+SCH *dst; /* server's IPv4 address */
+SCH *cookie;
+{
+	FILE *f;
+	char *path, line[TFO_LINE];
+	int i, n, h, l;
+
+	path = tfo_path();
+	if (!path || !(f = fopen(path, "r")))
+		return 0;
+	n = 0;
+	while (fgets(line, sizeof(line), f)) {
+		i = tfo_mine(line, dst);
+		if (!i)
+			continue;
+		for(n=0; n<TCP_COOKIE; n++, i+=2) {
+			h = tfo_hex(line[i]);
+			l = tfo_hex(line[i + 1]);
+			if (h < 0 || l < 0)
+				break;
+			cookie[n] = (h << 4) | l;
+		}
+		break;
+	}
+	fclose(f);
+	/* (a cookie is 4 to 16 bytes, and always even) */
+	return (n < 4 || (n & 1)) ? 0 : n;
+}
+
+/* keep a cookie of len bytes for dst, or forget the one we have if len
+   is zero */
+int tfo_save(dst, cookie, len)
+SCH *dst; /* server's IPv4 address */
+SCH *cookie;
+int len; /* its length */
+{
+	FILE *f;
+	char *path;
+	int i, n;
+
+	path = tfo_path();
+	if (!path)
+		return 0;
+	/* hold on to everyone else's, then write it out again with this
+	   one first */
+	n = 0;
+	if ((f = fopen(path, "r"))) {
+		while (n < TFO_LINES && fgets(tfo_keep[n], TFO_LINE, f)) {
+			/* (skipping anything that isn't a whole line) */
+			i = strlen(tfo_keep[n]);
+			if (!tfo_mine(tfo_keep[n], dst) &&
+					tfo_keep[n][i - 1] == '\n')
+				n++;
+		}
+		fclose(f);
+	}
+	if (!(f = fopen(path, "w")))
+		return 0;
+	if (len > 0) {
+		fprintf(f, "%d.%d.%d.%d ", dst[0] & 0xff, dst[1] & 0xff,
+			dst[2] & 0xff, dst[3] & 0xff);
+		for(i=0; i<len; i++)
+			fprintf(f, "%02x", cookie[i] & 0xff);
+		fprintf(f, "\n");
+		if (n == TFO_LINES)
+			n--;
+	}
+	for(i=0; i<n; i++)
+		fputs(tfo_keep[i], f);
+	fclose(f);
+	return 1;
+}
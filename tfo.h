@@ -0,0 +1,12 @@
+#if __GNUC__
+int tfo_load(SCH *dst, SCH *cookie);
+int tfo_save(SCH *dst, SCH *cookie, int len);
+#else
+int tfo_load();
+int tfo_save();
+#endif
+
+/* how many servers we keep cookies for. the ones used longest ago go. */
+#ifndef TFO_LINES
+#define TFO_LINES	16
+#endif
@@ -0,0 +1,176 @@
+/* Event trace for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * The DEBUG build used to print every byte and sequence number as it
+ * went, which slowed things down so much that timing problems went away
+ * when you looked for them. Instead, when tracing is on, interesting
+ * events (see trace.h) are logged in binary to a fixed-size ring in
+ * memory, and the ring is written to a file when we're done, so it can be
+ * left on without much of anyone noticing. tracefmt turns the file into
+ * something you can read.
+ *
+ * trace_start() turns tracing on, to be dumped to the given file.
+ * trace_log() logs an event; use the TRACE() macro, which doesn't bother
+ * calling it if tracing is off.
+ * trace_dump() writes the ring to the file. This happens by itself at exit
+ * (on POSIX systems; elsewhere, slip_stop() does it) or if we are killed
+ * by a signal.
+ * trace_word() is a convenience for logging 32-bit big-endian values, such
+ * as sequence numbers, out of a datagram.
+ */
+
+#include "compat.h"
+#include "trace.h"
+#include "wheel.h"
+#include <signal.h>
+
+struct event {
+	B32 ev_when;	/* wheel_now() */
+	B32 ev_a;
+	B32 ev_b;
+	int ev_what;
+};
+
+struct event trace_ring[TRACE_SLOTS];
+int trace_head = 0;	/* next slot to fill */
+B32 trace_n = 0;	/* events logged in all */
+int trace_on = 0;
+int trace_gone = 0;	/* set once we've dumped */
+char *trace_file = 0;
+
+/* signals we dump on, and what they did before we came along */
+int trace_ids[] = { SIGHUP, SIGINT, SIGPIPE, SIGTERM, 0 };
+SIGTYPE (*trace_chain[4])();
+
+int trace_log(what, a, b)
+int what;
+B32 a;
+B32 b;
+{
+	struct event *e;
+
+	e = &trace_ring[trace_head];
+	e->ev_when = wheel_now();
+	e->ev_what = what;
+	e->ev_a = a;
+	e->ev_b = b;
+	trace_head = (trace_head + 1) % TRACE_SLOTS;
+	trace_n++;
+	return 1;
+}
+
+/* four big-endian bytes to a number */
+B32 trace_word(p)
+SCH *p;
+{
+	return ((B32)(p[0] & 0xff) << 24) | ((B32)(p[1] & 0xff) << 16) |
+		((B32)(p[2] & 0xff) << 8) | (B32)(p[3] & 0xff);
+}
+
+/* put a 32-bit little-endian value in buf */
+int trace_emit(buf, v)
+SCH *buf;
+B32 v;
+{
+	buf[0] = v & 0xff;
+	buf[1] = (v >> 8) & 0xff;
+	buf[2] = (v >> 16) & 0xff;
+	buf[3] = (v >> 24) & 0xff;
+	return 4;
+}
+
+/* write the ring out, oldest first. this only uses open() and write(), so
+   it is safe to call from a signal handler. */
+int trace_dump()
+{
+	SCH buf[16 * 32];
+	struct event *e;
+	int fd, i, j, k, n;
+
+	if (!trace_on || trace_gone)
+		return 0;
+	trace_gone = 1;
+#if IS_POSIX
+	fd = open(trace_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+	fd = creat(trace_file, 0644);
+#endif
+	if (fd < 0)
+		return 0;
+	n = (trace_n < TRACE_SLOTS) ? trace_n : TRACE_SLOTS;
+	for(i=0; i<4; i++)
+		buf[i] = TRACE_MAGIC[i];
+	trace_emit(buf + 4, (B32)n);
+	write(fd, buf, 8);
+
+	j = 0;
+	k = (trace_head - n + TRACE_SLOTS) % TRACE_SLOTS;
+	for(i=0; i<n; i++) {
+		e = &trace_ring[(k + i) % TRACE_SLOTS];
+		j += trace_emit(buf + j, e->ev_when);
+		j += trace_emit(buf + j, (B32)e->ev_what);
+		j += trace_emit(buf + j, e->ev_a);
+		j += trace_emit(buf + j, e->ev_b);
+		if (j == sizeof(buf)) {
+			write(fd, buf, j);
+			j = 0;
+		}
+	}
+	if (j)
+		write(fd, buf, j);
+	close(fd);
+	return 1;
+}
+
+/* dump, then do whatever would have happened to us anyway */
+SIGTYPE trace_kill(sig)
+int sig;
+{
+	int i;
+
+	trace_dump();
+	for(i=0; trace_ids[i] && trace_ids[i] != sig; i++);
+	if (trace_ids[i] && trace_chain[i] != SIG_DFL) {
+		signal(sig, trace_chain[i]);
+		(*trace_chain[i])(sig);
+		return;
+	}
+	signal(sig, SIG_DFL);
+	kill(getpid(), sig);
+}
+
+#if IS_POSIX
+void trace_bye()
+{
+	trace_dump();
+}
+#endif
+
+/* turn tracing on, to be dumped to path when we're done */
+int trace_start(path)
+char *path;
+{
+	int i;
+
+	if (!path || !*path)
+		return 0;
+	trace_file = path;
+	trace_head = 0;
+	trace_n = 0;
+	trace_gone = 0;
+	if (!trace_on) {
+		for(i=0; trace_ids[i]; i++) {
+			trace_chain[i] = signal(trace_ids[i], trace_kill);
+			/* if it was being ignored, leave it that way */
+			if (trace_chain[i] == SIG_IGN)
+				signal(trace_ids[i], SIG_IGN);
+		}
+#if IS_POSIX
+		atexit(trace_bye);
+#endif
+	}
+	trace_on = 1;
+	return 1;
+}
@@ -0,0 +1,55 @@
+#if NO_TRACE
+/* built without it: there is no trace= option, and TRACE() is nothing */
+#define trace_start(p)	((void)0)
+#define trace_dump()	((void)0)
+#define TRACE(w, a, b)	((void)0)
+#else
+#if __GNUC__
+int trace_start(char *path);
+int trace_log(int what, B32 a, B32 b);
+B32 trace_word(SCH *p);
+#else
+int trace_start();
+int trace_log();
+B32 trace_word();
+#endif
+int trace_dump();
+
+extern int trace_on;
+
+/* log an event if tracing is on. this is all it costs if it isn't. */
+#define TRACE(w, a, b)	(trace_on ? trace_log((w), (B32)(a), (B32)(b)) : 0)
+#endif
+
+/* events, and what their two arguments are. see tracefmt.c for how they
+   are printed, and keep it up to date if you add any. */
+#define TR_TX		1	/* frame out: length, protocol << 8 | TCP flags */
+#define TR_RX		2	/* frame in: length, protocol << 8 | TCP flags */
+#define TR_NOTIP	3	/* not IPv4: length, first byte */
+#define TR_BADLEN	4	/* IP length mismatch: header says, we got */
+#define TR_BADHDR	5	/* bad IP header checksum: length, 0 */
+#define TR_BADESC	6	/* nonsense ESC: byte after it, length so far */
+#define TR_OVER		7	/* frame too big: buffer size, 0 */
+#define TR_LATE		8	/* partial frame abandoned: length so far, 0 */
+#define TR_CSUM		9	/* bad TCP or UDP checksum: protocol, length */
+#define TR_SEQ		10	/* unexpected ackno: ours, theirs */
+#define TR_RST		11	/* bailed on RST: port, flags */
+#define TR_FIN		12	/* bailed on FIN: port, flags */
+#define TR_REXMIT	13	/* retransmitted: tries so far, length */
+#define TR_TIMEOUT	14	/* gave up waiting: tries, 0 */
+#define TR_SEQNO	15	/* their ackno, our seqno */
+#define TR_ACKNO	16	/* their seqno, our ackno */
+#define TR_ANSWER	17	/* DNS answer: answers, address */
+#define TR_STRAY	18	/* datagram nobody wanted: protocol, port */
+#define TR_EVICT	19	/* held datagram dropped for room: protocol, port */
+#define TR_HOLD		20	/* early TCP data held: where past ackno, length */
+#define TR_RTT		21	/* round trip timed: ms, new RTO in ms */
+
+/* how many events we keep. the oldest are overwritten. */
+#ifndef TRACE_SLOTS
+#define TRACE_SLOTS	512
+#endif
+
+/* dump file: TRACE_MAGIC, then the number of events, then each event as
+   time in ms, what, a and b, all 32-bit little-endian */
+#define TRACE_MAGIC	"BTRC"
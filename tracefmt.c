@@ -0,0 +1,198 @@
+/* Trace formatter for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * Prints a trace file written by the trace= link setting (see trace.c) as
+ * one line per event, oldest first, with the time in seconds since the
+ * wheel started. It doesn't use the network, so it builds and runs on
+ * anything; the file doesn't care which system wrote it.
+ */
+
+#include "compat.h"
+#include "trace.h"
+
+FILE *in;
+
+/* read a 32-bit little-endian value. these are longs rather than B32s so
+   they print the same everywhere. returns zero at the end of the file. */
+int grab(v)
+long *v;
+{
+	int i, c;
+	long n;
+
+	n = 0;
+	for(i=0; i<4; i++) {
+		c = getc(in);
+		if (c == EOF)
+			return 0;
+		n |= ((long)(c & 0xff)) << (i * 8);
+	}
+	*v = n;
+	return 1;
+}
+
+/* protocol << 8 | TCP flags, as slip.c logs them */
+int proto(v)
+long v;
+{
+	int p, f;
+
+	p = (v >> 8) & 0xff;
+	f = v & 0xff;
+	if (p == 1) {
+		fprintf(stdout, "icmp");
+	} else if (p == 17) {
+		fprintf(stdout, "udp");
+	} else if (p == 6) {
+		fprintf(stdout, "tcp");
+		if (f & 0x02) fprintf(stdout, " SYN");
+		if (f & 0x10) fprintf(stdout, " ACK");
+		if (f & 0x08) fprintf(stdout, " PSH");
+		if (f & 0x01) fprintf(stdout, " FIN");
+		if (f & 0x04) fprintf(stdout, " RST");
+		if (f & 0x20) fprintf(stdout, " URG");
+	} else
+		fprintf(stdout, "proto %d", p);
+	return 1;
+}
+
+MAIN
+main(argc, argv)
+int argc;
+char **argv;
+{
+	long n, i, when, what, a, b;
+	int c;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s tracefile\n", argv[0]);
+		exit(255);
+	}
+	in = fopen(argv[1], "r");
+	if (!in) {
+		perror("fopen");
+		exit(1);
+	}
+	for(i=0; i<4; i++) {
+		c = getc(in);
+		if (c != TRACE_MAGIC[i]) {
+			fprintf(stderr, "%s is not a BASS trace\n", argv[1]);
+			exit(2);
+		}
+	}
+	if (!grab(&n))
+		exit(2);
+
+	for(i=0; i<n; i++) {
+		if (!grab(&when) || !grab(&what) || !grab(&a) || !grab(&b)) {
+			fprintf(stderr, "trace ends early\n");
+			exit(3);
+		}
+		fprintf(stdout, "%6lu.%03lu ",
+			(unsigned long)(when / 1000),
+			(unsigned long)(when % 1000));
+		switch(what) {
+			case TR_TX:
+				fprintf(stdout, "tx %lu ", (unsigned long)a);
+				proto(b);
+				break;
+			case TR_RX:
+				fprintf(stdout, "rx %lu ", (unsigned long)a);
+				proto(b);
+				break;
+			case TR_NOTIP:
+				fprintf(stdout, "not IPv4: %lu bytes, starts %02lx",
+					(unsigned long)a, (unsigned long)b);
+				break;
+			case TR_BADLEN:
+				fprintf(stdout, "bad length: header %lu, got %lu",
+					(unsigned long)a, (unsigned long)b);
+				break;
+			case TR_BADHDR:
+				fprintf(stdout, "bad IP header checksum: %lu bytes",
+					(unsigned long)a);
+				break;
+			case TR_BADESC:
+				fprintf(stdout, "bad ESC: then %02lx at %lu",
+					(unsigned long)a, (unsigned long)b);
+				break;
+			case TR_OVER:
+				fprintf(stdout, "frame over %lu bytes",
+					(unsigned long)a);
+				break;
+			case TR_LATE:
+				fprintf(stdout, "partial frame dropped: %lu bytes",
+					(unsigned long)a);
+				break;
+			case TR_CSUM:
+				fprintf(stdout, "bad checksum: ");
+				proto(a << 8);
+				fprintf(stdout, ", %lu bytes", (unsigned long)b);
+				break;
+			case TR_SEQ:
+				fprintf(stdout, "unexpected ackno: us %08lx | them %08lx",
+					(unsigned long)a, (unsigned long)b);
+				break;
+			case TR_RST:
+				fprintf(stdout, "RST on port %lu: ", (unsigned long)a);
+				proto(0x0600 | b);
+				break;
+			case TR_FIN:
+				fprintf(stdout, "FIN on port %lu: ", (unsigned long)a);
+				proto(0x0600 | b);
+				break;
+			case TR_REXMIT:
+				fprintf(stdout, "retransmit %lu: %lu bytes",
+					(unsigned long)a, (unsigned long)b);
+				break;
+			case TR_TIMEOUT:
+				fprintf(stdout, "timed out after %lu",
+					(unsigned long)a);
+				break;
+			case TR_SEQNO:
+				fprintf(stdout, "seqno: them %08lx | us %08lx",
+					(unsigned long)a, (unsigned long)b);
+				break;
+			case TR_ACKNO:
+				fprintf(stdout, "ackno: them %08lx | us %08lx",
+					(unsigned long)a, (unsigned long)b);
+				break;
+			case TR_ANSWER:
+				fprintf(stdout, "answer %lu: %lu.%lu.%lu.%lu",
+					(unsigned long)a,
+					(unsigned long)(b >> 24) & 0xff,
+					(unsigned long)(b >> 16) & 0xff,
+					(unsigned long)(b >> 8) & 0xff,
+					(unsigned long)b & 0xff);
+				break;
+			case TR_STRAY:
+				fprintf(stdout, "unwanted: ");
+				proto(a << 8);
+				fprintf(stdout, " port %lu", (unsigned long)b);
+				break;
+			case TR_EVICT:
+				fprintf(stdout, "held too long: ");
+				proto(a << 8);
+				fprintf(stdout, " port %lu", (unsigned long)b);
+				break;
+			case TR_HOLD:
+				fprintf(stdout, "early: %lu bytes, %lu ahead",
+					(unsigned long)b, (unsigned long)a);
+				break;
+			case TR_RTT:
+				fprintf(stdout, "rtt %lu ms: rto %lu ms",
+					(unsigned long)a, (unsigned long)b);
+				break;
+			default:
+				fprintf(stdout, "event %lu: %08lx %08lx",
+					(unsigned long)what,
+					(unsigned long)a, (unsigned long)b);
+				break;
+		}
+		fprintf(stdout, "\n");
+	}
+	fclose(in);
+	exit(0);
+}
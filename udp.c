@@ -0,0 +1,145 @@
+/* UDP helpers for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * This builds UDP datagrams the same way tcp.c builds TCP ones: the
+ * headers are set up once, along with the part of the checksums that
+ * never changes, and then each datagram only needs the rest.
+ *
+ * udp_prime() sets up a struct udb with our address and port and the
+ * server's. udp_build() fills in the headers of a datagram whose payload
+ * is already in place, and checksums it, and udp_gather() does the same
+ * for a payload in pieces elsewhere. You are responsible for sending it.
+ */
+
+#include "compat.h"
+#include "slip.h"
+#include "udp.h"
+
+int udp_prime(ud, src, dst, port, sport_h, sport_l)
+struct udb *ud; /* connection */
+SCH *src; /* our IPv4 address */
+SCH *dst; /* IPv4 address of the server */
+int port; /* port on the server */
+SCH sport_h; /* bogus source port, high byte */
+SCH sport_l; /* bogus source port, low byte */
+{
+	SCH *packet = ud->ud_head;
+	B32 sum;
+
+	slip_splat(packet, 28);
+
+	/***** IP header *****/
+	/* version and length of IP header */
+	packet[0] = 0x45;	/* IPv4, 5 32-bit ints == 20 bytes */
+	/* TOS as DSCP and ECN: just use zero */
+	packet[1] = 0x00;
+	/* length and identification vary, and fragmentation is none,
+	   not allowed, so they're all zero */
+	/* TTL of 64 */
+	packet[8] = 64;
+	/* protocol is UDP */
+	packet[9] = 17;
+	/* checksum is zero until we compute it */
+	/* source IP */
+	packet[12] = src[0];
+	packet[13] = src[1];
+	packet[14] = src[2];
+	packet[15] = src[3];
+	/* destination IP */
+	packet[16] = dst[0];
+	packet[17] = dst[1];
+	packet[18] = dst[2];
+	packet[19] = dst[3];
+
+	/***** UDP header *****/
+	/* source port. don't care, but make sure it matches */
+	packet[20] = sport_h;
+	packet[21] = sport_l;
+	/* destination port, big endian */
+	packet[22] = (port >> 8) & 0xff;
+	packet[23] = (port & 0xff);
+	/* length varies, checksum comes later */
+
+	/* IP checksum of everything but length and ID, which are zero */
+	ud->ud_isum = slip_part(packet, 20, (B32)0);
+	/* UDP checksum of the pseudo-header (addresses and protocol; the
+	   length varies) and ports */
+	sum = slip_part(packet + 12, 8, (B32)17);
+	ud->ud_usum = slip_part(packet + 20, 4, sum);
+	return 1;
+}
+
+/* fill in the headers of a datagram with len bytes of payload after them
+   (at packet + 28), and checksum it. returns the size. */
+int udp_build(ud, packet, len)
+struct udb *ud; /* connection from udp_prime() */
+SCH *packet; /* packet */
+int len; /* payload length */
+{
+	struct frag f[2];
+
+	f[0].fr_data = packet;
+	f[1].fr_data = packet + 28;
+	f[1].fr_size = len;
+	return udp_gather(ud, f, 2);
+}
+
+/* likewise, but the payload is in the pieces frag[1] to frag[n-1], and
+   the headers go in frag[0] (see tcp_gather()). send it with
+   slip_gather(frag, n). returns the size. */
+int udp_gather(ud, frag, n)
+struct udb *ud; /* connection from udp_prime() */
+struct frag *frag; /* headers, then payload */
+int n; /* how many pieces, including the headers */
+{
+	int i, size;
+	B32 sum, id;
+	B32 m = (B32)65535;
+	SCH *packet;
+
+	packet = frag[0].fr_data;
+	frag[0].fr_size = 28;
+	size = 0;
+	for(i=0; i<n; i++)
+		size += frag[i].fr_size;
+	for(i=0; i<28; i++)
+		packet[i] = ud->ud_head[i];
+
+	/* length of complete packet and payload, big endian */
+	packet[2] = (size >> 8) & 0xff;
+	packet[3] = (size & 0x00ff);
+
+	/* identification, big endian. RFC 6864 indicates that pretty much
+	   nothing relies on the uniqueness of the IPv4 ID field anymore. */
+	id = rand() & 0xffff;
+	packet[4] = (id >> 8) & 0xff;
+	packet[5] = (id & 0xff);
+
+	/* length again, minus IP header */
+	packet[24] = ((size - 20) >> 8) & 0xff;
+	packet[25] = ((size - 20) & 0x00ff);
+
+	/* UDP checksum: the fixed part, the length (twice: once in the
+	   pseudo-header, once in the UDP header) and the payload */
+	sum = ud->ud_usum + (B32)(size - 20) + (B32)(size - 20);
+	sum += slip_frag(frag + 1, n - 1);
+	while (sum > m)
+		sum = (sum & m) + ((sum >> 16) & m);
+	sum ^= m;
+	/* zero means no checksum in UDP, so send all ones (RFC 768) */
+	if (!sum)
+		sum = m;
+	packet[26] = (sum >> 8) & 0xff;
+	packet[27] = (sum & 0x00ff);
+
+	/* IP checksum: the fixed part, length and ID */
+	sum = ud->ud_isum + (B32)size + id;
+	while (sum > m)
+		sum = (sum & m) + ((sum >> 16) & m);
+	sum ^= m;
+	packet[10] = (sum >> 8) & 0xff;
+	packet[11] = (sum & 0x00ff);
+	return size;
+}
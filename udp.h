@@ -0,0 +1,18 @@
+/* a UDP "connection": the parts of its IP and UDP headers that never
+   change, and their partial checksums (see slip_part()), set up by
+   udp_prime() */
+struct udb {
+	SCH ud_head[28];
+	B32 ud_isum;	/* IP header, less length and ID */
+	B32 ud_usum;	/* pseudo-header and ports */
+};
+
+#if __GNUC__
+int udp_prime(struct udb *ud, SCH *src, SCH *dst, int port, SCH sport_h, SCH sport_l);
+int udp_build(struct udb *ud, SCH *packet, int len);
+int udp_gather(struct udb *ud, struct frag *frag, int n);
+#else
+int udp_prime();
+int udp_build();
+int udp_gather();
+#endif
@@ -0,0 +1,212 @@
+/* Event loop and timer wheel for BASS
+ * Copyright (C)2025, Cameron Kaiser. All rights reserved.
+ * oldvcr.blogspot.com
+ * BSD-2 clause
+ *
+ * This lets the rest of BASS wait on the link and on timers at the same
+ * time, so that nothing has to block forever waiting for a datagram that
+ * isn't coming.
+ *
+ * wheel_arm() sets a timer to go off in some number of milliseconds. When
+ * it does, its function is called, if it has one. If it doesn't, or the
+ * function returns non-zero, it sounds the alarm: the next wheel_wait()
+ * for input returns zero so that whoever is waiting can deal with it.
+ * The alarm doesn't say whose timer it was, so if yours is still live
+ * (tw_live), it wasn't yours and you should go back to waiting.
+ * wheel_drop() disarms a timer.
+ * wheel_wait() waits for the link to be ready for reading or writing, or
+ * for the alarm, running timers as they go off.
+ * wheel_turn() runs any timers that have gone off.
+ * wheel_now() returns a millisecond clock.
+ *
+ * Timers are kept in a hashed timing wheel: an array of slots, each a list
+ * of the timers that go off on a tick that hashes to it, so arming and
+ * dropping a timer is cheap and each tick only looks at one slot.
+ *
+ * With poll() (which is to say, IS_POSIX), this is a proper event loop. On
+ * other systems we can't wait on both at once, so the clock only has the
+ * resolution of time(), timers only go off between reads, and a read can
+ * still block forever.
+ */
+
+#include "compat.h"
+#include "wheel.h"
+
+#if IS_POSIX
+#define WHEEL_TICK	10	/* milliseconds */
+#else
+#define WHEEL_TICK	1000
+#endif
+#define WHEEL_SLOTS	64	/* must be a power of 2 */
+
+struct timer *wheel_slot[WHEEL_SLOTS];
+B32 wheel_tick = -1;	/* last tick we processed */
+long wheel_epoch = 0;	/* the second before we started */
+int wheel_begun = 0;
+int wheel_alarm = 0;
+
+/* milliseconds since we started. the seconds are counted from the epoch
+   before they become milliseconds, so this only overflows after 24 days
+   or so, however long the system has been up. */
+B32 wheel_now()
+{
+#if IS_POSIX
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (!wheel_begun) {
+		wheel_epoch = ts.tv_sec - 1;
+		wheel_begun = 1;
+	}
+	return (B32)(ts.tv_sec - wheel_epoch) * 1000L +
+		(B32)(ts.tv_nsec / 1000000L);
+#else
+	long ltime;
+
+	time(&ltime);
+	if (!wheel_begun) {
+		wheel_epoch = ltime - 1;
+		wheel_begun = 1;
+	}
+	return (B32)(ltime - wheel_epoch) * 1000L;
+#endif
+}
+
+int wheel_drop(t)
+struct timer *t;
+{
+	struct timer **p;
+
+	if (!t->tw_live)
+		return 0;
+	for(p = &wheel_slot[t->tw_when & (WHEEL_SLOTS - 1)]; *p;
+			p = &((*p)->tw_next)) {
+		if (*p == t) {
+			*p = t->tw_next;
+			break;
+		}
+	}
+	t->tw_live = 0;
+	return 1;
+}
+
+/* arm (or re-arm) a timer to go off in ms milliseconds */
+int wheel_arm(t, ms, func, arg)
+struct timer *t;
+B32 ms;
+int (*func)();
+SCH *arg;
+{
+	struct timer **p;
+
+	wheel_drop(t);
+	if (wheel_tick < 0)
+		wheel_tick = wheel_now() / WHEEL_TICK;
+	/* always at least one tick from now, rounding up */
+	t->tw_when = (wheel_now() + ms + WHEEL_TICK - 1) / WHEEL_TICK;
+	if (t->tw_when <= wheel_tick)
+		t->tw_when = wheel_tick + 1;
+	t->tw_func = func;
+	t->tw_arg = arg;
+	t->tw_live = 1;
+	p = &wheel_slot[t->tw_when & (WHEEL_SLOTS - 1)];
+	t->tw_next = *p;
+	*p = t;
+	return 1;
+}
+
+/* run everything that has gone off. returns non-zero if the alarm is up. */
+int wheel_turn()
+{
+	struct timer *t;
+	B32 now, tick;
+	int i;
+
+	now = wheel_now() / WHEEL_TICK;
+	if (wheel_tick < 0)
+		wheel_tick = now;
+	/* if we've been away a long time, one trip around is enough */
+	if (now - wheel_tick > WHEEL_SLOTS)
+		wheel_tick = now - WHEEL_SLOTS;
+	for(tick = wheel_tick + 1; tick <= now; tick++) {
+		/* so anything armed from here on goes off on a later tick */
+		wheel_tick = tick;
+		i = tick & (WHEEL_SLOTS - 1);
+		t = wheel_slot[i];
+		while (t) {
+			if (t->tw_when > now) {
+				t = t->tw_next;
+				continue;
+			}
+			wheel_drop(t);
+			if (!t->tw_func || (*t->tw_func)(t->tw_arg))
+				wheel_alarm = 1;
+			/* it may have re-armed itself (or others), so start
+			   the slot over */
+			t = wheel_slot[i];
+		}
+	}
+	return wheel_alarm;
+}
+
+/* wait until fd is ready for the events asked for, running timers in the
+   meantime. returns 1 when it's ready (or has an error that the read or
+   write will report), 0 if we were waiting for input and the alarm went
+   off (which also clears it), or -1 if something went wrong. */
+int wheel_wait(fd, events)
+int fd;
+int events;
+{
+#if IS_POSIX
+	struct pollfd pfd;
+	struct timer *t;
+	B32 next, ms;
+	int i;
+
+	for(;;) {
+		wheel_turn();
+		if (wheel_alarm && (events & WHEEL_IN)) {
+			wheel_alarm = 0;
+			return 0;
+		}
+
+		/* sleep no later than the next timer */
+		next = -1;
+		for(i=0; i<WHEEL_SLOTS; i++) {
+			for(t=wheel_slot[i]; t; t=t->tw_next) {
+				if (next < 0 || t->tw_when < next)
+					next = t->tw_when;
+			}
+		}
+		ms = -1;
+		if (next >= 0) {
+			ms = (next * WHEEL_TICK) - wheel_now();
+			if (ms < 0)
+				ms = 0;
+		}
+
+		pfd.fd = fd;
+		pfd.events = 0;
+		pfd.revents = 0;
+		if (events & WHEEL_IN)
+			pfd.events |= POLLIN;
+		if (events & WHEEL_OUT)
+			pfd.events |= POLLOUT;
+		i = poll(&pfd, 1, (int)ms);
+		if (i > 0)
+			return 1;
+		if (i < 0 && errno != EINTR) {
+			perror("wheel_wait: poll");
+			return -1;
+		}
+		/* otherwise, a timer is due */
+	}
+#else
+	/* we can only check between reads */
+	if (wheel_turn() && (events & WHEEL_IN)) {
+		wheel_alarm = 0;
+		return 0;
+	}
+	return 1;
+#endif
+}
@@ -0,0 +1,30 @@
+/* a timer. declare one wherever you like (they are zero when static) and
+   hand it to wheel_arm(). tw_live is set while it's armed, and cleared
+   when it goes off or is dropped, so you can check it to see if it has
+   expired. */
+struct timer {
+	struct timer *tw_next;	/* next timer in the same slot */
+	B32 tw_when;		/* tick it goes off on */
+	int (*tw_func)();	/* called when it goes off, if not null */
+	SCH *tw_arg;		/* passed to tw_func */
+	int tw_live;		/* set while armed */
+};
+
+#if __GNUC__
+int wheel_arm(struct timer *t, B32 ms, int (*func)(), SCH *arg);
+int wheel_drop(struct timer *t);
+int wheel_wait(int fd, int events);
+#else
+int wheel_arm();
+int wheel_drop();
+int wheel_wait();
+#endif
+B32 wheel_now();
+int wheel_turn();
+
+/* events for wheel_wait() */
+#define WHEEL_IN	1
+#define WHEEL_OUT	2
+
+/* set when a timer has woken us up, see wheel_wait() */
+extern int wheel_alarm;